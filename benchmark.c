@@ -0,0 +1,541 @@
+// Benchmarks for the simulator hot paths (headless, no raylib).
+// Build (it includes simulator.c wholesale, so not every static is used here):
+// gcc -Wall -Wno-unused-function -O2 -march=native benchmark.c -o benchmark -pthread
+//
+// Usage: ./benchmark [--vehicles N[,N...]] [--threads N[,N...]] [--records N]
+//                    [--warmup SECONDS] [--min-time SECONDS] [--repeat N] [--filter TEXT]
+
+#define HEADLESS
+#define SIMULATOR_NO_MAIN
+#include "simulator.c"
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const float BENCH_DT = 1.0f / 60.0f;
+
+// Measurement
+// A case is a body that runs `iters` iterations and returns the seconds they
+// took, so setup it does between iterations stays untimed, and how many
+// operations they were. Each case first runs for at least --warmup seconds
+// while the iteration count is raised until one call takes its share of
+// --min-time, then --repeat samples are timed; the median is reported (the
+// fastest alongside) so one noisy sample does not move the result.
+
+#define MAX_REPEAT 64
+
+typedef double (*BenchBody)(void *ctx, long iters, long *ops);
+
+typedef struct {
+    double nsPerOp;          // median sample
+    double minNsPerOp;       // fastest sample
+} BenchResult;
+
+static double benchWarmup = 0.1;
+static double benchMinTime = 0.25;
+static int benchRepeat = 5;
+static const char *benchFilter = NULL;
+
+static int CompareDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static BenchResult RunBench(BenchBody body, void *ctx) {
+    double target = benchMinTime / benchRepeat, spent = 0.0;
+    long iters = 1, ops = 0;
+    for (;;) {
+        double t = body(ctx, iters, &ops);
+        spent += t;
+        if (t >= target && spent >= benchWarmup) break;
+        if (t < target) {
+            long next = (t > 0.0) ? (long)(iters * (target / t) * 1.1) : iters * 10;
+            if (next > iters * 10) next = iters * 10;
+            iters = (next > iters) ? next : iters + 1;
+        }
+    }
+
+    double samples[MAX_REPEAT];
+    for (int r = 0; r < benchRepeat; r++) {
+        double t = body(ctx, iters, &ops);
+        samples[r] = (ops > 0) ? t * 1e9 / ops : 0.0;
+    }
+    qsort(samples, (size_t)benchRepeat, sizeof(double), CompareDouble);
+    return (BenchResult){samples[benchRepeat / 2], samples[0]};
+}
+
+static bool BenchSelected(const char *name) {
+    return !benchFilter || strstr(name, benchFilter);
+}
+
+static void PrintHeader(const char *title) {
+    printf("\n%s\n%-40s %10s %12s %12s %14s\n", title, "case", "size", "ns/op", "min ns/op", "ops/s");
+}
+
+static void PrintResult(const char *name, long size, BenchResult r) {
+    printf("%-40s %10ld %12.3f %12.3f %14.0f\n", name, size, r.nsPerOp, r.minNsPerOp,
+           r.nsPerOp > 0 ? 1e9 / r.nsPerOp : 0.0);
+}
+
+// Run one case (if --filter selects it) and print its row
+static void Bench(const char *name, long size, BenchBody body, void *ctx) {
+    if (!BenchSelected(name)) return;
+    PrintResult(name, size, RunBench(body, ctx));
+}
+
+static volatile long benchSink; // keeps results observable so loops are not elided
+
+// Kinematics
+
+// The array-of-structs vehicle record and update loop used before the SoA pool
+typedef struct {
+    float x, y;
+    float vx, vy;
+    int road;
+    int lane;
+    bool active;
+    char plate[16];
+} AosVehicle;
+
+// The full-pool culling kernel UpdateVehicles used before per-lane leader
+// checks: set bit i of mask when minX < x[i] < maxX and minY < y[i] < maxY
+static void InsideBoundsMask(const float *restrict x, const float *restrict y, int n,
+                             float minX, float maxX, float minY, float maxY,
+                             uint64_t *restrict mask) {
+    memset(mask, 0, (size_t)((n + 63) / 64) * sizeof(uint64_t));
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 lox = _mm256_set1_ps(minX), hix = _mm256_set1_ps(maxX);
+    __m256 loy = _mm256_set1_ps(minY), hiy = _mm256_set1_ps(maxY);
+    for (; i + 8 <= n; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+        __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(px, lox, _CMP_GT_OQ), _mm256_cmp_ps(px, hix, _CMP_LT_OQ)),
+                                  _mm256_and_ps(_mm256_cmp_ps(py, loy, _CMP_GT_OQ), _mm256_cmp_ps(py, hiy, _CMP_LT_OQ)));
+        mask[i >> 6] |= (uint64_t)_mm256_movemask_ps(in) << (i & 63);
+    }
+#elif defined(__SSE2__)
+    __m128 lox = _mm_set1_ps(minX), hix = _mm_set1_ps(maxX);
+    __m128 loy = _mm_set1_ps(minY), hiy = _mm_set1_ps(maxY);
+    for (; i + 4 <= n; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+        __m128 in = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(px, lox), _mm_cmplt_ps(px, hix)),
+                               _mm_and_ps(_mm_cmpgt_ps(py, loy), _mm_cmplt_ps(py, hiy)));
+        mask[i >> 6] |= (uint64_t)_mm_movemask_ps(in) << (i & 63);
+    }
+#endif
+    for (; i < n; i++)
+        if (x[i] > minX && x[i] < maxX && y[i] > minY && y[i] < maxY)
+            mask[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+typedef struct {
+    int n;
+    AosVehicle *aos;
+    uint64_t *screenMask;
+} KinematicsCase;
+
+static double BodyAosKinematics(void *ctx, long iters, long *ops) {
+    KinematicsCase *c = ctx;
+    AosVehicle *v = c->aos;
+    long outside = 0;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++) {
+        for (int i = 0; i < c->n; i++) {
+            if (!v[i].active) continue;
+            v[i].x += v[i].vx * BENCH_DT;
+            v[i].y += v[i].vy * BENCH_DT;
+            if (v[i].x < -200 || v[i].x > screenW + 200 || v[i].y < -200 || v[i].y > screenH + 200) outside++;
+        }
+    }
+    double elapsed = NowSeconds() - start;
+    benchSink += outside;
+    *ops = iters * c->n;
+    return elapsed;
+}
+
+static double BodySoaKinematics(void *ctx, long iters, long *ops) {
+    KinematicsCase *c = ctx;
+    int words = (c->n + 63) / 64;
+    long outside = 0;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++) {
+        IntegratePositions(vehicles.x, vehicles.y, vehicles.vx, vehicles.vy, c->n, BENCH_DT);
+        InsideBoundsMask(vehicles.x, vehicles.y, c->n, -200.0f, screenW + 200.0f, -200.0f, screenH + 200.0f,
+                         c->screenMask);
+        for (int w = 0; w < words; w++) outside += 64 - __builtin_popcountll(c->screenMask[w]);
+    }
+    double elapsed = NowSeconds() - start;
+    benchSink += outside;
+    *ops = iters * c->n;
+    return elapsed;
+}
+
+static void BenchKinematics(int n) {
+    KinematicsCase c = {n, calloc((size_t)n, sizeof(AosVehicle)), calloc((size_t)(n + 63) / 64, sizeof(uint64_t))};
+    for (int i = 0; i < n; i++) {
+        c.aos[i].active = true;
+        c.aos[i].x = (float)(i % screenW);
+        c.aos[i].y = (float)(i % screenH);
+        c.aos[i].vx = (i & 1) ? vehSpeed : 0.0f;
+        c.aos[i].vy = (i & 1) ? 0.0f : -vehSpeed;
+    }
+    Bench("integrate+cull AoS loop (vehicle)", n, BodyAosKinematics, &c);
+
+    InitVehicles();
+    InitNetwork(1, 1);
+    while (vehicleCapacity < n && GrowVehiclePool()) {}
+    for (int i = 0; i < n; i++) {
+        vehicles.x[i] = c.aos[i].x;
+        vehicles.y[i] = c.aos[i].y;
+        vehicles.vx[i] = c.aos[i].vx;
+        vehicles.vy[i] = c.aos[i].vy;
+    }
+    Bench("integrate+cull SoA kernel (vehicle)", n, BodySoaKinematics, &c);
+    free(c.aos);
+    free(c.screenMask);
+}
+
+// Lanes and scheduler
+
+// Build a rows × cols network and fill its approach lanes with n vehicles,
+// spread evenly over the intersections and spaced one headway apart
+// behind each lane's entry point
+static void PopulateApproachLanes(int n, int rows, int cols) {
+    InitVehicles();
+    InitNetwork(rows, cols);
+    for (int k = 0; k < n; k++) {
+        int node = k % nodeCount, road = (k / nodeCount) % 4, lane = 1 + (k / nodeCount / 4) % 2;
+        int ahead = nodes[node].queues[road][lane].count;
+        SpawnVehicle(node, road, lane, "BENCH");
+        int i = vehicleHighWater - 1;
+        float back = (CAR_LEN + minHeadway) * ahead;
+        switch (road) {
+            case 0: vehicles.y[i] -= back; break;
+            case 1: vehicles.y[i] += back; break;
+            case 2: vehicles.x[i] += back; break;
+            case 3: vehicles.x[i] -= back; break;
+        }
+    }
+}
+
+typedef struct {
+    int n, rows, cols;
+    LaneQueue q;
+} LaneCase;
+
+// One op is an Enqueue or a Dequeue on a lane holding 64 cars
+static double BodyQueueSteady(void *ctx, long iters, long *ops) {
+    LaneCase *c = ctx;
+    long sum = 0;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++) {
+        Enqueue(&c->q, (int)(t & 1023));
+        sum += Dequeue(&c->q);
+    }
+    double elapsed = NowSeconds() - start;
+    benchSink += sum;
+    *ops = 2 * iters;
+    return elapsed;
+}
+
+// Fill an empty lane with n cars (doubling as it goes) and drain it again
+static double BodyQueueFillDrain(void *ctx, long iters, long *ops) {
+    LaneCase *c = ctx;
+    long sum = 0;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++) {
+        LaneQueue q = {0};
+        for (int k = 0; k < c->n; k++) Enqueue(&q, k);
+        while (q.count > 0) sum += Dequeue(&q);
+        free(q.indices);
+    }
+    double elapsed = NowSeconds() - start;
+    benchSink += sum;
+    *ops = 2 * iters * c->n;
+    return elapsed;
+}
+
+static double BodyLaneCount(void *ctx, long iters, long *ops) {
+    (void)ctx;
+    long sum = 0;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++)
+        sum += LaneCount(&nodes[t % nodeCount], (int)(t & 3), (int)(t % 3));
+    double elapsed = NowSeconds() - start;
+    benchSink += sum;
+    *ops = iters;
+    return elapsed;
+}
+
+static double BodyLeadGap(void *ctx, long iters, long *ops) {
+    (void)ctx;
+    float sum = 0.0f;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++)
+        for (int i = 0; i < vehicleHighWater; i++) sum += LeadGap(i);
+    double elapsed = NowSeconds() - start;
+    benchSink += (long)sum;
+    *ops = iters * vehicleHighWater;
+    return elapsed;
+}
+
+static double BodyGreenDuration(void *ctx, long iters, long *ops) {
+    (void)ctx;
+    float sum = 0.0f;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++)
+        for (int n = 0; n < nodeCount; n++) sum += calculateGreenDuration(&nodes[n]);
+    double elapsed = NowSeconds() - start;
+    benchSink += (long)sum;
+    *ops = iters * nodeCount;
+    return elapsed;
+}
+
+// One op is one vehicle advanced one tick. Lanes are refilled every 10
+// ticks (untimed) so the queues do not drain over a long sample.
+static double BodyUpdateVehicles(void *ctx, long iters, long *ops) {
+    LaneCase *c = ctx;
+    const int ticksPerFill = 10;
+    double elapsed = 0.0;
+    for (long t = 0; t < iters; t += ticksPerFill) {
+        PopulateApproachLanes(c->n, c->rows, c->cols);
+        long ticks = (iters - t < ticksPerFill) ? iters - t : ticksPerFill;
+        double start = NowSeconds();
+        for (long k = 0; k < ticks; k++) UpdateVehicles(BENCH_DT);
+        elapsed += NowSeconds() - start;
+    }
+    *ops = iters * c->n;
+    return elapsed;
+}
+
+static void BenchLanes(int n) {
+    LaneCase c = {n, 1, 1, {0}};
+    InitVehicles();
+    while (vehicleCapacity < 1024 && GrowVehiclePool()) {}
+    for (int k = 0; k < 64; k++) Enqueue(&c.q, k);
+    Bench("LaneQueue Enqueue/Dequeue, 64 queued", 64, BodyQueueSteady, &c);
+    free(c.q.indices);
+    while (vehicleCapacity < n && GrowVehiclePool()) {}
+    Bench("LaneQueue fill + drain (grows)", n, BodyQueueFillDrain, &c);
+
+    PopulateApproachLanes(n, 50, 50);
+    Bench("LaneCount, 50x50 grid", nodeCount, BodyLaneCount, NULL);
+    Bench("LeadGap (vehicle), 50x50 grid", n, BodyLeadGap, NULL);
+    Bench("calculateGreenDuration (intersection)", nodeCount, BodyGreenDuration, NULL);
+
+    Bench("UpdateVehicles 1x1 (vehicle-tick)", n, BodyUpdateVehicles, &c);
+    c.rows = c.cols = 50;
+    Bench("UpdateVehicles 50x50 (vehicle-tick)", n, BodyUpdateVehicles, &c);
+}
+
+// Ingestion
+// vehicles.data is written once per format into a scratch directory (the
+// reader opens it relative to the working directory). Parsing reads the
+// whole file in one ReadArrivalLog call into a counting sink; the
+// PollVehicleFile case runs the per-tick path, reopening the file and
+// spawning up to MAX_SPAWNS_PER_TICK cars per call, as the simulator does.
+
+typedef enum { LOG_LEGACY, LOG_TEXT, LOG_BINARY } LogFormat;
+
+static long benchRecords = 100000;
+static long sinkCount;
+
+static void CountSink(const VehicleRecord *rec) {
+    sinkCount += rec->lane;
+}
+
+static void FillRecord(VehicleRecord *rec, long k) {
+    memset(rec, 0, sizeof(*rec));
+    rec->seq = (uint64_t)k;
+    snprintf(rec->plate, sizeof(rec->plate), "BN%06ld", k % 1000000);
+    rec->road = (uint8_t)(k & 3);
+    rec->lane = (uint8_t)(1 + (k >> 2) % 2);
+}
+
+static bool WriteVehicleLog(LogFormat format, long records) {
+    FILE *f = fopen(VEHICLE_LOG_FILE, "wb");
+    if (!f) return false;
+    if (format == LOG_BINARY) {
+        VehicleSegmentHeader h = {{'V', 'S', 'E', 'G'}, VEHICLE_LOG_VERSION, 1, sizeof(VehicleRecord), 0};
+        fwrite(&h, sizeof(h), 1, f);
+    } else if (format == LOG_TEXT) {
+        fprintf(f, "#SEG 1 0\n");
+    }
+    for (long k = 0; k < records; k++) {
+        VehicleRecord rec;
+        FillRecord(&rec, k);
+        if (format == LOG_BINARY) fwrite(&rec, sizeof(rec), 1, f);
+        else if (format == LOG_TEXT) fprintf(f, "%ld:%s:%c:%d\n", k, rec.plate, 'A' + rec.road, rec.lane);
+        else fprintf(f, "%s:%c:%d\n", rec.plate, 'A' + rec.road, rec.lane);
+    }
+    return fclose(f) == 0;
+}
+
+static void ResetArrivalReader(void) {
+    arrivalLog = (ArrivalLogReader){0, 0, -1, 0, 0};
+    vehiclesFilePos = 0;
+}
+
+// One op is one record parsed
+static double BodyParseLog(void *ctx, long iters, long *ops) {
+    (void)ctx;
+    long records = 0;
+    double start = NowSeconds();
+    for (long t = 0; t < iters; t++) {
+        ResetArrivalReader();
+        records += ReadArrivalLog(INT32_MAX, CountSink, true, false);
+    }
+    double elapsed = NowSeconds() - start;
+    *ops = records;
+    return elapsed;
+}
+
+// One op is one record ingested through PollVehicleFile (reopen, parse,
+// spawn); the world is reset, untimed, whenever the file has been consumed
+static double BodyPollVehicleFile(void *ctx, long iters, long *ops) {
+    (void)ctx;
+    long before = totalSpawned; // never reset, so it counts across world resets
+    double elapsed = 0.0;
+    for (long t = 0; t < iters; t++) {
+        if (arrivalLog.nextSeq >= (unsigned long long)benchRecords) {
+            InitVehicles();
+            InitNetwork(1, 1);
+            ResetArrivalReader();
+        }
+        double start = NowSeconds();
+        PollVehicleFile();
+        elapsed += NowSeconds() - start;
+    }
+    *ops = totalSpawned - before;
+    return elapsed;
+}
+
+static void BenchIngestion(void) {
+    char dir[] = "/tmp/dsa_bench_XXXXXX";
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir) || chdir(dir) != 0) {
+        fprintf(stderr, "cannot create a scratch directory for the ingestion benchmarks\n");
+        return;
+    }
+
+    static const struct { LogFormat format; const char *name; } cases[] = {
+        {LOG_LEGACY, "parse legacy PLATE:ROAD:LANE (record)"},
+        {LOG_TEXT, "parse text segment (record)"},
+        {LOG_BINARY, "parse binary segment (record)"},
+    };
+    for (int k = 0; k < 3; k++) {
+        if (!BenchSelected(cases[k].name)) continue;
+        if (!WriteVehicleLog(cases[k].format, benchRecords)) { fprintf(stderr, "cannot write %s\n", VEHICLE_LOG_FILE); break; }
+        Bench(cases[k].name, benchRecords, BodyParseLog, NULL);
+    }
+
+    const char *pollName = "PollVehicleFile binary, 16/tick (record)";
+    if (BenchSelected(pollName) && WriteVehicleLog(LOG_BINARY, benchRecords)) {
+        InitVehicles();
+        InitNetwork(1, 1);
+        ResetArrivalReader();
+        Bench(pollName, benchRecords, BodyPollVehicleFile, NULL);
+    }
+    benchSink += sinkCount;
+
+    remove(VEHICLE_LOG_FILE);
+    if (chdir(cwd) != 0) return;
+    rmdir(dir);
+}
+
+static const char *SimdPath(void) {
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+// Parse "N[,N...]" into out (at most 16 values); returns how many
+static int ParseList(char *arg, int *out) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < 16; tok = strtok(NULL, ",")) out[n++] = atoi(tok);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    int counts[16] = {10000, 100000};
+    int numCounts = 2;
+    int threadCounts[16];
+    int numThreadCounts = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--vehicles") == 0 && i + 1 < argc) {
+            numCounts = ParseList(argv[++i], counts);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreadCounts = ParseList(argv[++i], threadCounts);
+        } else if (strcmp(argv[i], "--records") == 0 && i + 1 < argc) {
+            benchRecords = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            benchWarmup = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            benchMinTime = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            benchRepeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            benchFilter = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--vehicles N[,N...]] [--threads N[,N...]] [--records N]\n"
+                            "       [--warmup SECONDS] [--min-time SECONDS] [--repeat N] [--filter TEXT]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (benchRepeat < 1) benchRepeat = 1;
+    if (benchRepeat > MAX_REPEAT) benchRepeat = MAX_REPEAT;
+    if (benchRecords < 1) benchRecords = 1;
+    if (numThreadCounts == 0) {
+        // 1, 2, 4, ... up to the core count
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int t = 1; numThreadCounts < 16; t *= 2) {
+            threadCounts[numThreadCounts++] = (t < cores) ? t : (int)cores;
+            if (t >= cores) break;
+        }
+    }
+
+    vehicleMaxCapacity = 0;
+    for (int c = 0; c < numCounts; c++)
+        if (counts[c] > vehicleMaxCapacity) vehicleMaxCapacity = counts[c];
+    if (vehicleMaxCapacity < benchRecords) vehicleMaxCapacity = (int)benchRecords;
+
+    printf("kinematics kernels: %s; warmup %.2fs, %d samples of %.3fs, median reported\n",
+           SimdPath(), benchWarmup, benchRepeat, benchMinTime / benchRepeat);
+
+    PrintHeader("kinematics, lanes and scheduler (single thread)");
+    StartWorkPool(1);
+    for (int c = 0; c < numCounts; c++) {
+        BenchKinematics(counts[c]);
+        BenchLanes(counts[c]);
+    }
+
+    PrintHeader("ingestion");
+    BenchIngestion();
+    StopWorkPool();
+
+    // parallel lane update scaling (results are identical at every thread count)
+    const char *scalingName = "UpdateVehicles 50x50 (vehicle-tick)";
+    if (!BenchSelected(scalingName)) return 0;
+    printf("\n%-40s %10s %8s %12s %8s\n", "case", "vehicles", "threads", "ns/op", "speedup");
+    for (int c = 0; c < numCounts; c++) {
+        LaneCase lc = {counts[c], 50, 50, {0}};
+        double base = 0.0;
+        for (int k = 0; k < numThreadCounts; k++) {
+            StartWorkPool(threadCounts[k]);
+            BenchResult r = RunBench(BodyUpdateVehicles, &lc);
+            int threads = simThreads;
+            StopWorkPool();
+            if (k == 0) base = r.nsPerOp;
+            printf("%-40s %10d %8d %12.3f %7.2fx\n", scalingName, counts[c], threads, r.nsPerOp, base / r.nsPerOp);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Seedable random numbers shared by traffic_generator.c and simulator.c.
+//
+// xoshiro256** generators, one per stream, all derived from a single run
+// seed with splitmix64. Each consumer (plates, arrivals, routing) draws from
+// its own stream, so adding or removing draws in one place does not shift
+// the sequence seen by the others, and the same seed reproduces a run.
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    RNG_STREAM_PLATES,       // licence plate characters
+    RNG_STREAM_ARRIVALS,     // road/lane choice, burst sizes, inter-arrival gaps
+    RNG_STREAM_ROUTING,      // turn choice at the intersection
+    RNG_STREAM_COUNT
+} RngStream;
+
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+static inline uint64_t SplitMix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Seed one stream of a run; different streams of the same seed are independent
+static inline void RngSeed(Rng *rng, uint64_t seed, RngStream stream) {
+    uint64_t sm = seed ^ (0xD1B54A32D192ED03ull * ((uint64_t)stream + 1));
+    for (int k = 0; k < 4; k++) rng->s[k] = SplitMix64(&sm);
+}
+
+static inline uint64_t RngRotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t RngNext(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = RngRotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = RngRotl(s[3], 45);
+    return result;
+}
+
+// Uniform integer in [min, max] (inclusive, like raylib's GetRandomValue), without modulo bias
+static inline int RngRange(Rng *rng, int min, int max) {
+    uint64_t span = (uint64_t)((int64_t)max - min) + 1;
+    uint64_t limit = UINT64_MAX - UINT64_MAX % span;
+    uint64_t r;
+    do r = RngNext(rng); while (r >= limit);
+    return min + (int)(r % span);
+}
+
+// Uniform double in [0, 1) from the top 53 bits
+static inline double RngUniform(Rng *rng) {
+    return (RngNext(rng) >> 11) * 0x1.0p-53;
+}
+
+// Seed for runs started without --seed; printed so the run can be repeated
+static inline uint64_t RngDefaultSeed(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    uint64_t sm = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    return SplitMix64(&sm) & 0xFFFFFFFFull; // short enough to retype
+}
+
+#endif // RNG_H
@@ -0,0 +1,334 @@
+// Parameter sweeps over headless simulations, one process per core.
+// gcc -Wall -O2 scenario_runner.c -o scenario_runner
+//
+// Usage: ./scenario_runner SWEEP_FILE
+//
+// The sweep file has one "name value[,value...]" setting per line ('#'
+// starts a comment). These names configure the runner itself:
+//   simulator PATH   headless simulator to run (default ./simulator_headless)
+//   jobs N           simulations at once (default 0 = one per online CPU)
+//   replicas N       runs per parameter combination (default 1)
+//   seed N           seed of replica 0; replica k uses seed N+k (default 1)
+//   output FILE      results table (default: standard output)
+// Every other name is passed to the simulator as --name value, and a comma
+// separated list sweeps it: the runner executes every combination of the
+// listed values, `replicas` times each. Replica k of every combination
+// uses the same seed, so combinations are compared on the same arrival
+// stream. A sweep must set `arrivals RATE` (a seeded synthetic stream per
+// run) or `replay TRACE` (a recorded one); runs never read the shared
+// vehicles.data, whose contents depend on when each run starts. The results
+// table has one CSV row per combination: the swept values, then throughput
+// and delay metrics averaged over its replicas.
+//
+// POSIX only (fork/exec); run sweeps on Linux or macOS.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define MAX_PARAMS 32
+#define MAX_VALUES 32
+#define MAX_TEXT 128
+
+typedef struct {
+    char name[MAX_TEXT];
+    char values[MAX_VALUES][MAX_TEXT];
+    int count;
+} SweepParam;
+
+// Metrics of one finished run, read back from its --metrics-json file
+typedef struct {
+    bool ok;
+    double seconds, spawned, exited, dropped, crossings;
+    double waitMean, waitP50, waitP95, waitP99;
+    double queueMean, queueP50, queueP95, queueP99;
+    double wall;
+} RunResult;
+
+static SweepParam params[MAX_PARAMS];
+static int paramCount = 0;
+static char simulatorPath[MAX_TEXT] = "./simulator_headless";
+static char outputPath[MAX_TEXT] = "";
+static int jobs = 0;
+static int replicas = 1;
+static unsigned long long baseSeed = 1;
+
+static char *Trim(char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) *--end = '\0';
+    return s;
+}
+
+static bool LoadSweep(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return false; }
+    char line[4096];
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *name = Trim(line);
+        if (*name == '\0') continue;
+        char *value = name + strcspn(name, " \t");
+        if (*value) *value++ = '\0';
+        value = Trim(value);
+        if (*value == '\0') {
+            fprintf(stderr, "%s:%d: '%s' has no value\n", path, lineNo, name);
+            fclose(f);
+            return false;
+        }
+
+        if (strcmp(name, "simulator") == 0) snprintf(simulatorPath, sizeof(simulatorPath), "%s", value);
+        else if (strcmp(name, "output") == 0) snprintf(outputPath, sizeof(outputPath), "%s", value);
+        else if (strcmp(name, "jobs") == 0) jobs = atoi(value);
+        else if (strcmp(name, "replicas") == 0) replicas = atoi(value);
+        else if (strcmp(name, "seed") == 0) baseSeed = strtoull(value, NULL, 0);
+        else if (strcmp(name, "metrics-json") == 0 || strcmp(name, "metrics-every") == 0) {
+            fprintf(stderr, "%s:%d: '%s' is set by the runner\n", path, lineNo, name);
+        } else {
+            if (paramCount == MAX_PARAMS) { fprintf(stderr, "%s:%d: too many parameters\n", path, lineNo); fclose(f); return false; }
+            SweepParam *p = &params[paramCount++];
+            snprintf(p->name, sizeof(p->name), "%s", name);
+            p->count = 0;
+            for (char *tok = strtok(value, ","); tok; tok = strtok(NULL, ",")) {
+                if (p->count == MAX_VALUES) { fprintf(stderr, "%s:%d: too many values\n", path, lineNo); fclose(f); return false; }
+                snprintf(p->values[p->count++], MAX_TEXT, "%s", Trim(tok));
+            }
+        }
+    }
+    fclose(f);
+    if (replicas < 1) replicas = 1;
+    // without its own arrival source every run would race the others through
+    // the shared vehicles.data, each seeing a different part of the stream
+    bool ownArrivals = false;
+    for (int k = 0; k < paramCount; k++)
+        if (strcmp(params[k].name, "arrivals") == 0 || strcmp(params[k].name, "replay") == 0) ownArrivals = true;
+    if (!ownArrivals) {
+        fprintf(stderr, "%s: set 'arrivals RATE' or 'replay TRACE' so every run has its own arrival stream\n", path);
+        return false;
+    }
+    return true;
+}
+
+static long CombinationCount(void) {
+    long n = 1;
+    for (int k = 0; k < paramCount; k++) n *= params[k].count;
+    return n;
+}
+
+// Value index of parameter k in combination c (the last parameter varies fastest)
+static int ValueIndex(long c, int k) {
+    for (int j = paramCount - 1; j > k; j--) c /= params[j].count;
+    return (int)(c % params[k].count);
+}
+
+// Number after `keys` in order (each searched for after the previous), e.g.
+// {"\"all\"", "\"wait_s\"", "\"p50\""}; the metrics JSON is ours, so no full parser
+static bool JsonNumber(const char *json, const char *const *keys, int n, double *out) {
+    const char *at = json;
+    for (int k = 0; k < n; k++) {
+        at = strstr(at, keys[k]);
+        if (!at) return false;
+        at += strlen(keys[k]);
+    }
+    at = strchr(at, ':');
+    return at && sscanf(at + 1, "%lf", out) == 1;
+}
+
+#define JSON_FIELD(json, out, ...) \
+    JsonNumber((json), (const char *const[]){__VA_ARGS__}, \
+               (int)(sizeof((const char *const[]){__VA_ARGS__}) / sizeof(const char *)), (out))
+
+static RunResult ReadRunResult(const char *path) {
+    RunResult r = {0};
+    FILE *f = fopen(path, "r");
+    if (!f) return r;
+    char json[65536];
+    size_t len = fread(json, 1, sizeof(json) - 1, f);
+    fclose(f);
+    json[len] = '\0';
+
+    r.ok = JSON_FIELD(json, &r.seconds, "\"time_s\"") &&
+           JSON_FIELD(json, &r.spawned, "\"spawned\"") &&
+           JSON_FIELD(json, &r.exited, "\"exited\"") &&
+           JSON_FIELD(json, &r.dropped, "\"dropped\"") &&
+           JSON_FIELD(json, &r.crossings, "\"all\"", "\"crossings\"") &&
+           JSON_FIELD(json, &r.waitP50, "\"all\"", "\"wait_s\"", "\"p50\"") &&
+           JSON_FIELD(json, &r.waitP95, "\"all\"", "\"wait_s\"", "\"p95\"") &&
+           JSON_FIELD(json, &r.waitP99, "\"all\"", "\"wait_s\"", "\"p99\"") &&
+           JSON_FIELD(json, &r.waitMean, "\"all\"", "\"wait_s\"", "\"mean\"") &&
+           JSON_FIELD(json, &r.queueP50, "\"all\"", "\"queue_delay_s\"", "\"p50\"") &&
+           JSON_FIELD(json, &r.queueP95, "\"all\"", "\"queue_delay_s\"", "\"p95\"") &&
+           JSON_FIELD(json, &r.queueP99, "\"all\"", "\"queue_delay_s\"", "\"p99\"") &&
+           JSON_FIELD(json, &r.queueMean, "\"all\"", "\"queue_delay_s\"", "\"mean\"");
+    return r;
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#ifndef _WIN32
+static char scratchDir[] = "/tmp/scenario_runner_XXXXXX";
+
+static void RunFile(char *buf, size_t size, long run, const char *ext) {
+    snprintf(buf, size, "%s/run-%ld.%s", scratchDir, run, ext);
+}
+
+// Start run `run` (combination run / replicas, replica run % replicas); returns its pid
+static pid_t LaunchRun(long run) {
+    long combo = run / replicas;
+    int replica = (int)(run % replicas);
+    char seed[32], json[256], log[256];
+    snprintf(seed, sizeof(seed), "%llu", baseSeed + (unsigned long long)replica);
+    RunFile(json, sizeof(json), run, "json");
+    RunFile(log, sizeof(log), run, "log");
+
+    // Fixed arguments before and after the sweep's; argv is sized from them
+    const char *head[] = {simulatorPath, "--seed", seed,
+                          "--threads", "1"}; // one core per simulation; a sweep value can override it
+    const char *tail[] = {"--metrics-json", json,
+                          "--metrics-every", "1e12"}; // only the final export
+    enum { HEAD_ARGS = sizeof(head) / sizeof(head[0]), TAIL_ARGS = sizeof(tail) / sizeof(tail[0]) };
+    const char *argv[HEAD_ARGS + 2 * MAX_PARAMS + TAIL_ARGS + 1];
+    int argc = 0;
+    for (int k = 0; k < HEAD_ARGS; k++) argv[argc++] = head[k];
+    char names[MAX_PARAMS][MAX_TEXT + 2];
+    for (int k = 0; k < paramCount; k++) {
+        names[k][0] = names[k][1] = '-';
+        memcpy(names[k] + 2, params[k].name, sizeof(params[k].name));
+        argv[argc++] = names[k];
+        argv[argc++] = params[k].values[ValueIndex(combo, k)];
+    }
+    for (int k = 0; k < TAIL_ARGS; k++) argv[argc++] = tail[k];
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        int logFd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (devNull >= 0) dup2(devNull, STDOUT_FILENO);
+        if (logFd >= 0) dup2(logFd, STDERR_FILENO);
+        execv(simulatorPath, (char *const *)argv);
+        fprintf(stderr, "cannot run %s\n", simulatorPath);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Run every combination × replica, at most `jobs` at a time
+static bool RunAll(RunResult *results, long runs) {
+    pid_t *pids = calloc((size_t)runs, sizeof(pid_t));
+    double *started = calloc((size_t)runs, sizeof(double));
+    if (!pids || !started) { free(pids); free(started); return false; }
+    long next = 0, done = 0, failed = 0;
+    int running = 0;
+    while (done < runs) {
+        while (running < jobs && next < runs) {
+            started[next] = NowSeconds();
+            pids[next] = LaunchRun(next);
+            if (pids[next] < 0) { perror("fork"); results[next].ok = false; next++; done++; failed++; continue; }
+            next++;
+            running++;
+        }
+        if (running == 0) continue;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) { perror("waitpid"); break; }
+        long run = 0;
+        while (run < next && pids[run] != pid) run++;
+        if (run == next) continue;
+        running--;
+        done++;
+
+        char json[256], log[256];
+        RunFile(json, sizeof(json), run, "json");
+        RunFile(log, sizeof(log), run, "log");
+        results[run] = ReadRunResult(json);
+        results[run].wall = NowSeconds() - started[run];
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) results[run].ok = false;
+        if (results[run].ok) {
+            remove(log);
+        } else {
+            failed++;
+            fprintf(stderr, "\rrun %ld failed, see %s\n", run, log);
+        }
+        remove(json);
+        fprintf(stderr, "\r%ld/%ld runs done", done, runs);
+    }
+    fprintf(stderr, "\n");
+    free(pids);
+    free(started);
+    return failed == 0;
+}
+#endif
+
+// One row per combination, metrics averaged over its successful replicas
+static void WriteResults(FILE *out, const RunResult *results, long combos) {
+    for (int k = 0; k < paramCount; k++) fprintf(out, "%s,", params[k].name);
+    fprintf(out, "runs,crossings_per_min,wait_mean_s,wait_p50_s,wait_p95_s,wait_p99_s,"
+                 "queue_mean_s,queue_p50_s,queue_p95_s,queue_p99_s,spawned,exited,dropped,wall_s\n");
+    for (long c = 0; c < combos; c++) {
+        RunResult sum = {0};
+        int ok = 0;
+        for (int k = 0; k < replicas; k++) {
+            const RunResult *r = &results[c * replicas + k];
+            if (!r->ok) continue;
+            ok++;
+            sum.crossings += (r->seconds > 0) ? r->crossings * 60.0 / r->seconds : 0.0;
+            sum.waitMean += r->waitMean; sum.waitP50 += r->waitP50; sum.waitP95 += r->waitP95; sum.waitP99 += r->waitP99;
+            sum.queueMean += r->queueMean; sum.queueP50 += r->queueP50; sum.queueP95 += r->queueP95; sum.queueP99 += r->queueP99;
+            sum.spawned += r->spawned; sum.exited += r->exited; sum.dropped += r->dropped;
+            sum.wall += r->wall;
+        }
+        for (int k = 0; k < paramCount; k++) fprintf(out, "%s,", params[k].values[ValueIndex(c, k)]);
+        double n = ok ? ok : 1;
+        fprintf(out, "%d,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f,%.1f,%.2f\n", ok,
+                sum.crossings / n, sum.waitMean / n, sum.waitP50 / n, sum.waitP95 / n, sum.waitP99 / n,
+                sum.queueMean / n, sum.queueP50 / n, sum.queueP95 / n, sum.queueP99 / n,
+                sum.spawned / n, sum.exited / n, sum.dropped / n, sum.wall / n);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SWEEP_FILE\n", argv[0]);
+        return 1;
+    }
+#ifdef _WIN32
+    fprintf(stderr, "scenario_runner needs fork/exec; run sweeps on Linux or macOS\n");
+    return 1;
+#else
+    if (!LoadSweep(argv[1])) return 1;
+    if (jobs < 1) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1) jobs = 1;
+    if (!mkdtemp(scratchDir)) { perror("mkdtemp"); return 1; }
+
+    long combos = CombinationCount(), runs = combos * replicas;
+    fprintf(stderr, "%ld combinations x %d replicas = %ld runs, %d at a time\n", combos, replicas, runs, jobs);
+    RunResult *results = calloc((size_t)runs, sizeof(RunResult));
+    if (!results) return 1;
+    bool allOk = RunAll(results, runs);
+
+    FILE *out = stdout;
+    if (outputPath[0] && !(out = fopen(outputPath, "w"))) { perror(outputPath); return 1; }
+    WriteResults(out, results, combos);
+    if (out != stdout) fclose(out);
+    free(results);
+    if (allOk) rmdir(scratchDir);
+    return allOk ? 0 : 1;
+#endif
+}
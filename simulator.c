@@ -1,82 +1,540 @@
 // Build (MSYS2 MinGW64 example): 
 // gcc simulator.c -o simulator.exe -lraylib -lopengl32 -lgdi32 -lwinmm
+//
+// Headless build (no raylib, no window, fixed timestep):
+// gcc -Wall -O2 -DHEADLESS simulator.c -o simulator_headless -lm -pthread
+// Add -march=native (or -mavx2) to enable the AVX2 kinematics kernels.
 
+#ifndef HEADLESS
 #include "raylib.h"
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#include "rng.h"
+#include "vehicle_ipc.h"
+
+#ifdef HEADLESS
+// Stand-ins for the few raylib types/helpers the simulation core uses
+typedef struct {
+    float x, y;
+} Vector2;
+#endif
+
+
+// Vehicle storage (structure of arrays)
+// Hot kinematic state (x, y, vx, vy) lives in separate float arrays so the
+// integration and culling kernels stream only what they touch; lane
+// assignment and the plate text sit in their own arrays. Slot i is live when
+// bit i of `active` is set; free slots keep zero velocity so the kinematics
+// kernel can run over the whole [0, vehicleHighWater) range unmasked.
+
+typedef struct {
+    float *x, *y;            // position
+    float *vx, *vy;          // velocity
+    unsigned char *road;     // road: 0=A,1=B,2=C,3=D
+    unsigned char *lane;     // lane index: 0=L1,1=L2,2=L3
+    unsigned short *node;    // intersection whose lane the vehicle is on
+    int *queueSlot;          // slot in nodes[node].queues[road][lane].indices
+    char (*plate)[16];       // vehicle plate
+    double *entryTime;       // sim time it spawned or was handed onto its approach lane
+    double *haltTime;        // sim time it first stopped on that lane, < 0 if it has not
+    uint64_t *active;        // bitmap of live slots
+} VehiclePool;
+
+static VehiclePool vehicles;
+
+static inline bool IsVehicleActive(int i) {
+    return (vehicles.active[i >> 6] >> (i & 63)) & 1u;
+}
+
+// Vehicle pool
+// Slots are handed out from a LIFO free list (O(1)); when it is empty the
+// pool bumps vehicleHighWater, doubling the allocation up to vehicleMaxCapacity
+// (--max-vehicles). Only slots below vehicleHighWater have ever been used.
+
+#define VEHICLE_INITIAL_CAPACITY 64
+#define DEFAULT_MAX_VEHICLES 262144
+
+static int vehicleCapacity = 0;
+static int vehicleMaxCapacity = DEFAULT_MAX_VEHICLES;
+static int vehicleHighWater = 0;
+static int *freeSlots = NULL;          // stack of released slot indices
+static int freeSlotCount = 0;
+static long droppedSpawns = 0;         // arrivals lost because the pool was full
+
+static bool GrowArray(void **arr, size_t elemSize, int newCap) {
+    void *p = realloc(*arr, (size_t)newCap * elemSize);
+    if (!p) return false;
+    *arr = p;
+    return true;
+}
+
+static bool GrowVehiclePool(void) {
+    if (vehicleCapacity >= vehicleMaxCapacity) return false;
+    int newCap = vehicleCapacity ? vehicleCapacity * 2 : VEHICLE_INITIAL_CAPACITY;
+    if (newCap > vehicleMaxCapacity) newCap = vehicleMaxCapacity;
+    int oldWords = (vehicleCapacity + 63) / 64;
+    int newWords = (newCap + 63) / 64;
+
+    if (!GrowArray((void **)&vehicles.x, sizeof(float), newCap) ||
+        !GrowArray((void **)&vehicles.y, sizeof(float), newCap) ||
+        !GrowArray((void **)&vehicles.vx, sizeof(float), newCap) ||
+        !GrowArray((void **)&vehicles.vy, sizeof(float), newCap) ||
+        !GrowArray((void **)&vehicles.road, sizeof(unsigned char), newCap) ||
+        !GrowArray((void **)&vehicles.lane, sizeof(unsigned char), newCap) ||
+        !GrowArray((void **)&vehicles.node, sizeof(unsigned short), newCap) ||
+        !GrowArray((void **)&vehicles.queueSlot, sizeof(int), newCap) ||
+        !GrowArray((void **)&vehicles.plate, sizeof(vehicles.plate[0]), newCap) ||
+        !GrowArray((void **)&vehicles.entryTime, sizeof(double), newCap) ||
+        !GrowArray((void **)&vehicles.haltTime, sizeof(double), newCap) ||
+        !GrowArray((void **)&vehicles.active, sizeof(uint64_t), newWords) ||
+        !GrowArray((void **)&freeSlots, sizeof(int), newCap))
+        return false;
+
+    for (int i = vehicleCapacity; i < newCap; i++) {
+        vehicles.x[i] = vehicles.y[i] = 0.0f;
+        vehicles.vx[i] = vehicles.vy[i] = 0.0f;
+    }
+    for (int w = oldWords; w < newWords; w++) vehicles.active[w] = 0;
+    vehicleCapacity = newCap;
+    return true;
+}
+
+// Returns a free slot index, or -1 if the pool is at its configured limit
+static int AllocVehicleSlot(void) {
+    int i;
+    if (freeSlotCount > 0) i = freeSlots[--freeSlotCount];
+    else if (vehicleHighWater < vehicleCapacity || GrowVehiclePool()) i = vehicleHighWater++;
+    else return -1;
+    vehicles.active[i >> 6] |= (uint64_t)1 << (i & 63);
+    return i;
+}
+
+static void FreeVehicleSlot(int i) {
+    vehicles.active[i >> 6] &= ~((uint64_t)1 << (i & 63));
+    vehicles.vx[i] = vehicles.vy[i] = 0.0f;
+    freeSlots[freeSlotCount++] = i;
+}
+
+// Kinematics kernel (SSE/AVX2 when the compiler targets them, scalar otherwise)
+
+// x += vx*dt, y += vy*dt for slots [0, n)
+static void IntegratePositions(float *restrict x, float *restrict y,
+                               const float *restrict vx, const float *restrict vy,
+                               int n, float dt) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256 vdt = _mm256_set1_ps(dt);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(_mm256_loadu_ps(vx + i), vdt)));
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(_mm256_loadu_ps(vy + i), vdt)));
+    }
+#elif defined(__SSE2__)
+    __m128 vdt = _mm_set1_ps(dt);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(vx + i), vdt)));
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(vy + i), vdt)));
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+    }
+}
+
+
+// Work-stealing thread pool
+// ParallelFor(count, grain, fn, arg) runs fn over [0, count) in pieces of
+// at most `grain` items. Each worker (the calling thread is worker 0) gets
+// an equal share as a [begin, end) range packed into one atomic word; it
+// takes pieces from the front of its own range, and once that is empty it
+// steals the back half of another worker's range. The call returns when
+// every item has run. Without pthreads (Windows builds) it runs inline.
+
+#define MAX_SIM_THREADS 64
+
+typedef void (*ParallelTask)(int begin, int end, void *arg);
+
+static int simThreads = 1; // --threads, set by StartWorkPool
+
+#ifndef _WIN32
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range; // begin | end << 32
+} WorkerRange;
+
+static struct {
+    pthread_t tids[MAX_SIM_THREADS];
+    WorkerRange ranges[MAX_SIM_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    unsigned long generation;            // bumped for every job, under lock
+    bool stopping;
+    ParallelTask fn;
+    void *arg;
+    int grain;
+    _Atomic int remaining;               // items of the current job not yet run
+    _Atomic int busy;                    // helper threads still inside the job
+} workPool = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+static inline uint64_t PackRange(uint32_t begin, uint32_t end) {
+    return (uint64_t)begin | (uint64_t)end << 32;
+}
+
+// Run pieces of the current job until no worker has any left
+static void RunWorkerShare(int self) {
+    for (;;) {
+        _Atomic uint64_t *own = &workPool.ranges[self].range;
+        uint64_t r = atomic_load(own);
+        uint32_t b = (uint32_t)r, e = (uint32_t)(r >> 32);
+        if (b < e) {
+            uint32_t nb = (e - b > (uint32_t)workPool.grain) ? b + workPool.grain : e;
+            if (!atomic_compare_exchange_weak(own, &r, PackRange(nb, e))) continue;
+            workPool.fn((int)b, (int)nb, workPool.arg);
+            atomic_fetch_sub(&workPool.remaining, (int)(nb - b));
+            continue;
+        }
+
+        // own range empty: steal the back half of someone else's
+        bool stole = false;
+        for (int k = 1; k < simThreads && !stole; k++) {
+            _Atomic uint64_t *victim = &workPool.ranges[(self + k) % simThreads].range;
+            uint64_t v = atomic_load(victim);
+            uint32_t vb = (uint32_t)v, ve = (uint32_t)(v >> 32);
+            if (vb >= ve) continue;
+            uint32_t mid = vb + (ve - vb) / 2;
+            if (atomic_compare_exchange_strong(victim, &v, PackRange(vb, mid))) {
+                atomic_store(own, PackRange(mid, ve));
+                stole = true;
+            }
+        }
+        if (!stole) return;
+    }
+}
+
+static void *WorkerMain(void *arg) {
+    int self = (int)(intptr_t)arg;
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&workPool.lock);
+        while (workPool.generation == seen && !workPool.stopping)
+            pthread_cond_wait(&workPool.wake, &workPool.lock);
+        seen = workPool.generation;
+        bool stop = workPool.stopping;
+        pthread_mutex_unlock(&workPool.lock);
+        if (stop) return NULL;
+
+        RunWorkerShare(self);
+        atomic_fetch_sub(&workPool.busy, 1);
+    }
+}
+
+// Start threads-1 helper threads (0 = one per online CPU)
+static void StartWorkPool(int threads) {
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > MAX_SIM_THREADS) threads = MAX_SIM_THREADS;
+    workPool.stopping = false;
+    simThreads = 1;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&workPool.tids[t], NULL, WorkerMain, (void *)(intptr_t)t) != 0) break;
+        simThreads++;
+    }
+}
+
+static void StopWorkPool(void) {
+    pthread_mutex_lock(&workPool.lock);
+    workPool.stopping = true;
+    pthread_cond_broadcast(&workPool.wake);
+    pthread_mutex_unlock(&workPool.lock);
+    for (int t = 1; t < simThreads; t++) pthread_join(workPool.tids[t], NULL);
+    simThreads = 1;
+}
+
+static void ParallelFor(int count, int grain, ParallelTask fn, void *arg) {
+    if (count <= 0) return;
+    if (simThreads == 1 || count <= grain) {
+        fn(0, count, arg);
+        return;
+    }
 
+    workPool.fn = fn;
+    workPool.arg = arg;
+    workPool.grain = grain;
+    atomic_store(&workPool.remaining, count);
+    atomic_store(&workPool.busy, simThreads - 1);
+    for (int t = 0; t < simThreads; t++)
+        atomic_store(&workPool.ranges[t].range,
+                     PackRange((uint32_t)((long)count * t / simThreads),
+                               (uint32_t)((long)count * (t + 1) / simThreads)));
+
+    pthread_mutex_lock(&workPool.lock);
+    workPool.generation++;
+    pthread_cond_broadcast(&workPool.wake);
+    pthread_mutex_unlock(&workPool.lock);
+
+    RunWorkerShare(0);
+    // wait for pieces still running elsewhere, and for every helper to leave
+    // the job before its ranges are reused
+    while (atomic_load(&workPool.remaining) > 0 || atomic_load(&workPool.busy) > 0) sched_yield();
+}
+#else
+static void StartWorkPool(int threads) { (void)threads; }
+static void StopWorkPool(void) {}
+static void ParallelFor(int count, int grain, ParallelTask fn, void *arg) {
+    (void)grain;
+    if (count > 0) fn(0, count, arg);
+}
+#endif
+
+
+// Profiler
+// Build with -DSIM_PROFILE to time each phase of a simulation tick and of a
+// UI frame. PROFILE_ZONE(zone) times the rest of the enclosing block (GCC's
+// cleanup attribute ends it), appends a begin/duration event to the calling
+// thread's ring buffer and adds to the zone's running totals. --trace FILE
+// writes the buffered events as Chrome trace-event JSON (chrome://tracing,
+// Perfetto) at exit; the UI shows a per-phase breakdown (P toggles it) and
+// the headless run prints one. Without SIM_PROFILE the macro is empty.
+
+typedef enum {
+    PROF_TICK,               // SimulationStep as a whole
+    PROF_INGEST,
+    PROF_PRIORITY,           // UpdateAl2PriorityState over every intersection
+    PROF_SIGNALS,            // phase logic and alert timers
+    PROF_CONTROL,            // car-following pass
+    PROF_INTEGRATE,
+    PROF_ADVANCE,            // box crossings and hand-offs
+    PROF_METRICS,            // metrics export
+    PROF_CHECKPOINT,         // state copy for the checkpoint writer
+    PROF_PUBLISH,            // snapshot copy for the UI
+    PROF_DRAW_STATIC,        // road layer and legend
+    PROF_DRAW_LIGHTS,
+    PROF_DRAW_VEHICLES,
+    PROF_DRAW_HUD,           // alerts, overlays and status text
+    PROF_PRESENT,            // EndDrawing: buffer swap and VSync wait
+    PROF_ZONE_COUNT
+} ProfileZone;
+
+#ifdef SIM_PROFILE
+#define PROFILE_RING 65536   // events kept per thread, must be a power of two
+#define PROFILE_THREADS 2    // 0 = main/render thread, 1 = UI simulation thread
+
+static const char *profileZoneNames[PROF_ZONE_COUNT] = {
+    "SimulationStep", "IngestArrivals", "UpdateAl2PriorityState", "UpdateSignal",
+    "ControlLanes", "IntegratePositions", "AdvanceLaneLeaders", "ExportMetrics", "SaveCheckpoint",
+    "PublishSnapshot", "DrawStaticLayers", "DrawLights", "DrawVehicles", "DrawHud", "EndDrawing"
+};
 
-// Vehicle structure
+typedef struct {
+    int64_t start, dur;      // ns on the profiler clock
+    int zone;
+} ProfileEvent;
+
+static struct {
+    ProfileEvent events[PROFILE_RING];
+    uint64_t head;           // events written; only the owning thread writes
+} profileRings[PROFILE_THREADS];
+
+static _Atomic int64_t profileTotalNs[PROF_ZONE_COUNT];
+static _Atomic int64_t profileCalls[PROF_ZONE_COUNT];
+static _Thread_local int profileThread = 0;
+static const char *profileTracePath = NULL; // --trace
+
+static inline int64_t ProfileNowNs(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    return WallClockNs();
+#endif
+}
 
 typedef struct {
-    float x, y;       // position
-    float vx, vy;     // velocity
-    int road;         // road: 0=A,1=B,2=C,3=D
-    int lane;         // lane index: 0=L1,1=L2,2=L3
-    bool active;      // is vehicle active
-    char plate[16];   // vehicle plate
-} Vehicle;
+    int zone;
+    int64_t start;
+} ProfileScope;
+
+static inline ProfileScope ProfileBegin(int zone) {
+    return (ProfileScope){zone, ProfileNowNs()};
+}
+
+static inline void ProfileEnd(ProfileScope *scope) {
+    int64_t dur = ProfileNowNs() - scope->start;
+    __typeof__(profileRings[0]) *ring = &profileRings[profileThread];
+    ring->events[ring->head & (PROFILE_RING - 1)] = (ProfileEvent){scope->start, dur, scope->zone};
+    ring->head++;
+    atomic_fetch_add_explicit(&profileTotalNs[scope->zone], dur, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profileCalls[scope->zone], 1, memory_order_relaxed);
+}
 
-#define MAX_VEH 64
-static Vehicle vehicles[MAX_VEH];
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(zone) \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__) __attribute__((cleanup(ProfileEnd))) = ProfileBegin(zone)
+
+// Write the buffered events of every thread as Chrome trace-event JSON.
+// Call once the threads that record have stopped.
+static void WriteProfileTrace(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) { fprintf(stderr, "cannot write %s\n", path); return; }
+    static const char *threadNames[PROFILE_THREADS] = {"main", "simulation"};
+    int64_t origin = INT64_MAX;
+    for (int t = 0; t < PROFILE_THREADS; t++) {
+        uint64_t head = profileRings[t].head, first = (head > PROFILE_RING) ? head - PROFILE_RING : 0;
+        for (uint64_t k = first; k < head; k++) // events are stored as they end, so not in start order
+            if (profileRings[t].events[k & (PROFILE_RING - 1)].start < origin)
+                origin = profileRings[t].events[k & (PROFILE_RING - 1)].start;
+    }
+
+    fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n", f);
+    bool firstEvent = true;
+    for (int t = 0; t < PROFILE_THREADS; t++) {
+        uint64_t head = profileRings[t].head, first = (head > PROFILE_RING) ? head - PROFILE_RING : 0;
+        if (head == first) continue;
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                firstEvent ? "" : ",\n", t, threadNames[t]);
+        firstEvent = false;
+        for (uint64_t k = first; k < head; k++) {
+            const ProfileEvent *e = &profileRings[t].events[k & (PROFILE_RING - 1)];
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    profileZoneNames[e->zone], t, (e->start - origin) / 1000.0, e->dur / 1000.0);
+        }
+    }
+    fputs("\n]}\n", f);
+    fclose(f);
+}
+
+// Totals per zone since start, as a table
+static void PrintProfileSummary(FILE *out) {
+    int64_t tickNs = atomic_load(&profileTotalNs[PROF_TICK]);
+    fprintf(out, "%-24s %10s %12s %10s %8s\n", "zone", "calls", "total ms", "avg us", "% tick");
+    for (int z = 0; z < PROF_ZONE_COUNT; z++) {
+        int64_t calls = atomic_load(&profileCalls[z]), ns = atomic_load(&profileTotalNs[z]);
+        if (calls == 0) continue;
+        fprintf(out, "%-24s %10lld %12.3f %10.3f %8.1f\n", profileZoneNames[z], (long long)calls, ns / 1e6,
+                ns / 1e3 / calls, (z < PROF_DRAW_STATIC && tickNs > 0) ? 100.0 * ns / tickNs : 0.0);
+    }
+}
+#else
+#define PROFILE_ZONE(zone) ((void)0)
+#endif
 
 
 // Queue for each lane
+// The queue is the authoritative lane order: front is the lane leader
+// (closest to the stop line / furthest along), rear is the most recently
+// entered car, and vehicles.queueSlot[i] is car i's handle into the ring.
+// The ring doubles when full, so a lane can hold any number of vehicles; if
+// it cannot grow the enqueue fails and is counted in queueOverflows.
+
+#define LANE_QUEUE_INITIAL_CAPACITY 16
 
 typedef struct {
-    int indices[MAX_VEH];
+    int *indices;
+    int capacity;
     int front;
     int rear;
     int count;
 } LaneQueue;
 
-static LaneQueue laneQueues[4][3]; // 4 roads × 3 lanes
-
-// Initialize queues
-static void InitQueues(void) {
-    for (int r = 0; r < 4; r++)
-        for (int l = 0; l < 3; l++) {
-            laneQueues[r][l].front = 0;
-            laneQueues[r][l].rear = -1;
-            laneQueues[r][l].count = 0;
-        }
+// Reallocate the ring in front-to-rear order and re-slot its vehicles
+static bool GrowLaneQueue(LaneQueue *q) {
+    int newCap = q->capacity ? q->capacity * 2 : LANE_QUEUE_INITIAL_CAPACITY;
+    int *ni = malloc((size_t)newCap * sizeof(int));
+    if (!ni) return false;
+    for (int k = 0; k < q->count; k++) {
+        ni[k] = q->indices[(q->front + k) % q->capacity];
+        vehicles.queueSlot[ni[k]] = k;
+    }
+    free(q->indices);
+    q->indices = ni;
+    q->capacity = newCap;
+    q->front = 0;
+    q->rear = q->count - 1;
+    return true;
 }
 
-// Enqueue vehicle index into lane queue
-static void Enqueue(LaneQueue *q, int vehIndex) {
-    if (q->count >= MAX_VEH) return; // safety
-    q->rear = (q->rear + 1) % MAX_VEH;
+static long queueOverflows = 0; // cars removed because their lane queue could not grow
+
+// Enqueue vehicle index into lane queue. Returns false when the ring is full
+// and cannot grow; the caller must then take the car out of the simulation.
+static bool Enqueue(LaneQueue *q, int vehIndex) {
+    if (q->count >= q->capacity && !GrowLaneQueue(q)) { queueOverflows++; return false; }
+    q->rear = (q->rear + 1) % q->capacity;
     q->indices[q->rear] = vehIndex;
     q->count++;
+    vehicles.queueSlot[vehIndex] = q->rear;
+    return true;
 }
 
 // Dequeue vehicle index from lane queue
 static int Dequeue(LaneQueue *q) {
     if (q->count <= 0) return -1;
     int idx = q->indices[q->front];
-    q->front = (q->front + 1) % MAX_VEH;
+    q->front = (q->front + 1) % q->capacity;
     q->count--;
     return idx;
 }
 
+// Remove vehicle vehIndex from the queue by its handle, keeping the others in
+// order. O(1) for the lane leader, the usual case; otherwise the cars behind
+// it move up one slot. Returns false if the car is not in this queue.
+static bool RemoveFromQueue(LaneQueue *q, int vehIndex) {
+    int slot = vehicles.queueSlot[vehIndex];
+    if (q->count <= 0 || slot < 0 || slot >= q->capacity) return false;
+    if ((slot - q->front + q->capacity) % q->capacity >= q->count || q->indices[slot] != vehIndex) return false;
+    if (slot == q->front) { Dequeue(q); return true; }
+    while (slot != q->rear) {
+        int next = (slot + 1) % q->capacity;
+        q->indices[slot] = q->indices[next];
+        vehicles.queueSlot[q->indices[slot]] = slot;
+        slot = next;
+    }
+    q->rear = (q->rear + q->capacity - 1) % q->capacity;
+    q->count--;
+    return true;
+}
+
 // Simulation variables
+// timePerVehicle, vehSpeed, minHeadway and the priority thresholds can be
+// overridden at startup (--time-per-vehicle, --speed, --min-headway,
+// --priority-on, --priority-off) so parameter sweeps need no rebuild.
 
-static int currentGreen = 1;          
-static float phaseTimer = 0.0f;       
-static float currentGreenDuration = 0.0f;
-static const float TIME_PER_VEHICLE = 0.8f;
+static float timePerVehicle = 0.8f;
 static long vehiclesFilePos = 0;
-static const float VEH_SPEED = 80.0f;
+static float vehSpeed = 80.0f;
 static const float CAR_LEN = 36.0f;
+#ifndef HEADLESS
 static const float CAR_WID = 18.0f;
-static const float MIN_HEADWAY = 24.0f;
-static const int MAX_SPAWNS_PER_TICK = 16;
-static float laneSatTimer[4][3] = {0};
-static bool al2PriorityActive = false;
-static const int PRIORITY_ON_THRESHOLD = 10;
-static const int PRIORITY_OFF_THRESHOLD = 5;
+#endif
+static float minHeadway = 24.0f;
+#define MAX_SPAWNS_PER_TICK 16
+static int priorityOnThreshold = 10;
+static int priorityOffThreshold = 5;
+static long totalSpawned = 0;
+static long totalExited = 0;
 
 
 // Layout
@@ -88,8 +546,76 @@ static const int laneWidth = 60;
 static int centerX = 1200 / 2;
 static int centerY = 900 / 2;
 
+#ifndef HEADLESS
+static Color backgroundColor = {220, 226, 230, 255};
 static Color roadColor = {90, 90, 90, 255};
 static Color laneColor = {140, 140, 140, 255};
+#endif
+
+
+// Road network
+// Every intersection owns its lane queues, lane counts and signal state.
+// The default network is the single intersection centred in the window,
+// whose exit lanes run off screen. With --grid RxC (headless) intersections
+// sit on a grid NODE_SPACING apart: a car leaving on road r's exit lane
+// (L1) drives to the neighbour in that direction and joins one of its
+// approach lanes; only cars leaving the edge of the grid are removed.
+
+#define NODE_SPACING 800
+#define MAX_NETWORK_NODES 65535 // vehicles.node is 16 bits
+
+typedef struct {
+    float cx, cy;              // centre of the intersection box
+    int neighbor[4];           // node reached through road r's exit lane, -1 at the grid edge
+    LaneQueue queues[4][3];    // 4 roads × 3 lanes
+    int occupancy[4][3];       // vehicles per lane, see LaneCount
+    float satTimer[4][3];      // > 0 while the lane's saturation alert shows
+    int currentGreen;
+    float phaseTimer;
+    float greenDuration;
+    bool al2PriorityActive;
+} Intersection;
+
+static Intersection *nodes = NULL;
+static int nodeCount = 0;
+static int gridRows = 1, gridCols = 1;
+
+// Build a rows × cols network with empty lanes (1 × 1: the on-screen junction)
+static bool InitNetwork(int rows, int cols) {
+    for (int n = 0; n < nodeCount; n++)
+        for (int r = 0; r < 4; r++)
+            for (int l = 0; l < 3; l++) free(nodes[n].queues[r][l].indices);
+    nodeCount = 0;
+
+    Intersection *p = realloc(nodes, (size_t)rows * cols * sizeof(Intersection));
+    if (!p) return false;
+    nodes = p;
+    nodeCount = rows * cols;
+    gridRows = rows;
+    gridCols = cols;
+    memset(nodes, 0, (size_t)nodeCount * sizeof(Intersection));
+
+    for (int n = 0; n < nodeCount; n++) {
+        Intersection *node = &nodes[n];
+        int row = n / cols, col = n % cols;
+        if (nodeCount == 1) {
+            node->cx = (float)centerX;
+            node->cy = (float)centerY;
+        } else {
+            node->cx = col * NODE_SPACING + NODE_SPACING / 2.0f;
+            node->cy = row * NODE_SPACING + NODE_SPACING / 2.0f;
+        }
+        node->neighbor[0] = (row > 0) ? n - cols : -1;        // A: up
+        node->neighbor[1] = (row < rows - 1) ? n + cols : -1; // B: down
+        node->neighbor[2] = (col < cols - 1) ? n + 1 : -1;    // C: right
+        node->neighbor[3] = (col > 0) ? n - 1 : -1;           // D: left
+        for (int r = 0; r < 4; r++)
+            for (int l = 0; l < 3; l++) node->queues[r][l].rear = -1;
+        node->currentGreen = 1;
+        node->greenDuration = timePerVehicle;
+    }
+    return true;
+}
 
 
 // Utility functions
@@ -102,66 +628,145 @@ static float LaneLateralOffset(int road, int lane) {
     return -roadWidth/2.0f + laneWidth*slot + laneWidth*0.5f;
 }
 
-static void SetLaneSpeed(Vehicle *v, float speed) {
-    switch (v->road) {
-        case 0: v->vx=0; v->vy=(v->lane==0)?-speed:speed; break;
-        case 1: v->vx=0; v->vy=(v->lane==0)?speed:-speed; break;
-        case 2: v->vy=0; v->vx=(v->lane==0)?speed:-speed; break;
-        case 3: v->vy=0; v->vx=(v->lane==0)?-speed:speed; break;
-        default: v->vx=v->vy=0; break;
+static void SetLaneSpeed(int i, float speed) {
+    float *vx = &vehicles.vx[i], *vy = &vehicles.vy[i];
+    int lane = vehicles.lane[i];
+    switch (vehicles.road[i]) {
+        case 0: *vx=0; *vy=(lane==0)?-speed:speed; break;
+        case 1: *vx=0; *vy=(lane==0)?speed:-speed; break;
+        case 2: *vy=0; *vx=(lane==0)?speed:-speed; break;
+        case 3: *vy=0; *vx=(lane==0)?-speed:speed; break;
+        default: *vx=*vy=0; break;
     }
 }
 
-static void InitVehicles(void) {
-    for(int i=0;i<MAX_VEH;i++) vehicles[i].active=false;
+// Point on a lane of road `road`, `dist` px out from the intersection centre
+static Vector2 LanePoint(const Intersection *n, int road, int lane, float dist) {
+    float lateral = LaneLateralOffset(road, lane);
+    switch (road) {
+        case 0: return (Vector2){n->cx + lateral, n->cy - dist};
+        case 1: return (Vector2){n->cx + lateral, n->cy + dist};
+        case 2: return (Vector2){n->cx + dist, n->cy + lateral};
+        default: return (Vector2){n->cx - dist, n->cy + lateral};
+    }
+}
+
+// How far out along its road vehicle i is from its intersection's centre
+static float DistanceFromNode(int i) {
+    const Intersection *n = &nodes[vehicles.node[i]];
+    switch (vehicles.road[i]) {
+        case 0: return n->cy - vehicles.y[i];
+        case 1: return vehicles.y[i] - n->cy;
+        case 2: return vehicles.x[i] - n->cx;
+        default: return n->cx - vehicles.x[i];
+    }
+}
+
+// Where a road's approach lanes start: half-way to the neighbour on a grid,
+// just off the window edge for the on-screen junction
+static float ApproachEntryDistance(const Intersection *n, int road) {
+    if (nodeCount > 1) return NODE_SPACING / 2.0f;
+    switch (road) {
+        case 0: return n->cy + 40;
+        case 1: return screenH - n->cy + 40;
+        case 2: return screenW - n->cx + 40;
+        default: return n->cx + 40;
+    }
+}
+
+// Where a road's exit lane ends (hand-off to the neighbour, or removal)
+static float ExitDistance(const Intersection *n, int road) {
+    if (nodeCount > 1) return NODE_SPACING / 2.0f;
+    return ApproachEntryDistance(n, road) + 160.0f;
 }
 
 
 // Lane counting & averaging
+// Intersection.occupancy is kept up to date on spawn, intersection
+// transition, hand-off and removal so scheduler queries are O(1). Build
+// with -DSIM_DEBUG to check it, and the lane queues, every tick.
+
+static void OccupancyEnter(Intersection *n, int road, int lane) { n->occupancy[road][lane]++; }
+static void OccupancyLeave(Intersection *n, int road, int lane) { n->occupancy[road][lane]--; }
 
-static int LaneCount(int road, int lane) {
-    int c=0;
-    for(int i=0;i<MAX_VEH;i++)
-        if(vehicles[i].active && vehicles[i].road==road && vehicles[i].lane==lane) c++;
-    return c;
+static int LaneCount(const Intersection *n, int road, int lane) {
+    return n->occupancy[road][lane];
 }
 
-static float calculateAverageVehicles(void) {
-    int sum = LaneCount(0,1)+LaneCount(1,1)+LaneCount(2,1)+LaneCount(3,1);
+// A car joins or leaves a lane through these so its queue and the occupancy
+// table never disagree. JoinLane drops the car (freeing its slot) if the
+// queue cannot take it.
+static bool JoinLane(Intersection *n, int road, int lane, int i) {
+    if (!Enqueue(&n->queues[road][lane], i)) { FreeVehicleSlot(i); return false; }
+    OccupancyEnter(n, road, lane);
+    return true;
+}
+
+static void LeaveLane(Intersection *n, int road, int lane, int i) {
+    if (RemoveFromQueue(&n->queues[road][lane], i)) OccupancyLeave(n, road, lane);
+}
+
+
+static void InitVehicles(void) {
+    vehicleHighWater=0;
+    freeSlotCount=0;
+    droppedSpawns=0;
+    queueOverflows=0;
+    if(!vehicleCapacity) GrowVehiclePool();
+    memset(vehicles.active,0,(size_t)((vehicleCapacity+63)/64)*sizeof(uint64_t));
+    memset(vehicles.vx,0,(size_t)vehicleCapacity*sizeof(float));
+    memset(vehicles.vy,0,(size_t)vehicleCapacity*sizeof(float));
+}
+
+static float calculateAverageVehicles(const Intersection *n) {
+    int sum = LaneCount(n,0,1)+LaneCount(n,1,1)+LaneCount(n,2,1)+LaneCount(n,3,1);
     return sum/4.0f;
 }
 
-static float calculateGreenDuration(void) {
-    float avg = calculateAverageVehicles();
-    float duration = avg*TIME_PER_VEHICLE;
-    if(duration<TIME_PER_VEHICLE) duration=TIME_PER_VEHICLE;
+static float calculateGreenDuration(const Intersection *n) {
+    float avg = calculateAverageVehicles(n);
+    float duration = avg*timePerVehicle;
+    if(duration<timePerVehicle) duration=timePerVehicle;
     return duration;
 }
 
-static void UpdateAl2PriorityState(void) {
-    int al2Count = LaneCount(0,1);
-    if(!al2PriorityActive && al2Count>=PRIORITY_ON_THRESHOLD){
-        al2PriorityActive=true;
-        currentGreen=0;
-        phaseTimer=0.0f;
-    } else if(al2PriorityActive && al2Count<=PRIORITY_OFF_THRESHOLD){
-        al2PriorityActive=false;
-        phaseTimer=0.0f;
-        currentGreenDuration=calculateGreenDuration();
+static void UpdateAl2PriorityState(Intersection *n) {
+    int al2Count = LaneCount(n,0,1);
+    if(!n->al2PriorityActive && al2Count>=priorityOnThreshold){
+        n->al2PriorityActive=true;
+        n->currentGreen=0;
+        n->phaseTimer=0.0f;
+    } else if(n->al2PriorityActive && al2Count<=priorityOffThreshold){
+        n->al2PriorityActive=false;
+        n->phaseTimer=0.0f;
+        n->greenDuration=calculateGreenDuration(n);
     }
 }
 
+// Random streams (rng.h), seeded once per run by SeedSimulation
+static uint64_t simSeed = 0;
+static Rng plateRng;
+static Rng arrivalRng;
+static Rng routingRng;
+
+static void SeedSimulation(uint64_t seed) {
+    simSeed = seed;
+    RngSeed(&plateRng, seed, RNG_STREAM_PLATES);
+    RngSeed(&arrivalRng, seed, RNG_STREAM_ARRIVALS);
+    RngSeed(&routingRng, seed, RNG_STREAM_ROUTING);
+}
+
 // Vehicle plate generator
 
 static void GenerateVehicleNumber(char *buffer) {
-    buffer[0]='A'+GetRandomValue(0,25);
-    buffer[1]='A'+GetRandomValue(0,25);
-    buffer[2]='0'+GetRandomValue(0,9);
-    buffer[3]='A'+GetRandomValue(0,25);
-    buffer[4]='A'+GetRandomValue(0,25);
-    buffer[5]='0'+GetRandomValue(0,9);
-    buffer[6]='0'+GetRandomValue(0,9);
-    buffer[7]='0'+GetRandomValue(0,9);
+    buffer[0]='A'+RngRange(&plateRng,0,25);
+    buffer[1]='A'+RngRange(&plateRng,0,25);
+    buffer[2]='0'+RngRange(&plateRng,0,9);
+    buffer[3]='A'+RngRange(&plateRng,0,25);
+    buffer[4]='A'+RngRange(&plateRng,0,25);
+    buffer[5]='0'+RngRange(&plateRng,0,9);
+    buffer[6]='0'+RngRange(&plateRng,0,9);
+    buffer[7]='0'+RngRange(&plateRng,0,9);
     buffer[8]='\0';
 }
 
@@ -171,238 +776,610 @@ static void GenerateVehicleNumber(char *buffer) {
 // - L2 (lane index 1) = controlled/outgoing lane (obeys light)
 // - L3 (lane index 2) = free left-turn (never stops)
 // Only L2 should stop when the road is not green.
-static bool ShouldStop(const Vehicle *v) {
-    if (v->lane == 2) return false;        // free left-turn never stops
-    if (v->lane == 1) {                    // only L2 obeys the traffic light
-        if (v->road != currentGreen) return true; // red for this road
+static bool ShouldStop(int i) {
+    if (vehicles.lane[i] == 2) return false;        // free left-turn never stops
+    if (vehicles.lane[i] == 1) {                    // only L2 obeys the traffic light
+        if (vehicles.road[i] != nodes[vehicles.node[i]].currentGreen) return true; // red for this road
         return false;
     }
     // L1 (lane 0) does not obey the road-level traffic light in this simplified model
     return false;
 }
 
-static float LaneTravelCoordinate(const Vehicle *v) {
-    switch (v->road) {
-        case 0: return (v->lane == 0) ? -v->y : v->y;
-        case 1: return (v->lane == 0) ? v->y : -v->y;
-        case 2: return (v->lane == 0) ? v->x : -v->x;
-        case 3: return (v->lane == 0) ? -v->x : v->x;
+static float LaneTravelCoordinate(int i) {
+    float x = vehicles.x[i], y = vehicles.y[i];
+    bool exitLane = (vehicles.lane[i] == 0);
+    switch (vehicles.road[i]) {
+        case 0: return exitLane ? -y : y;
+        case 1: return exitLane ? y : -y;
+        case 2: return exitLane ? x : -x;
+        case 3: return exitLane ? -x : x;
         default: return 0.0f;
     }
 }
 
-// Get lead vehicle distance along travel axis for simple car-following spacing
-static float LeadGap(const Vehicle *self) {
-    float best = 1e9f;
-    for (int i = 0; i < MAX_VEH; i++) {
-        const Vehicle *o = &vehicles[i];
-        if (!o->active || o == self) continue;
-        if (o->road != self->road || o->lane != self->lane) continue;
+// Get lead vehicle distance along travel axis for simple car-following spacing.
+// The leader is the previous entry in the lane queue, so this is O(1).
+static float LeadGap(int self) {
+    const LaneQueue *q = &nodes[vehicles.node[self]].queues[vehicles.road[self]][vehicles.lane[self]];
+    int slot = vehicles.queueSlot[self];
+    if (q->count <= 0 || slot == q->front) return 1e9f; // lane leader
+    int leaderSlot = (slot + q->capacity - 1) % q->capacity;
+    return LaneTravelCoordinate(q->indices[leaderSlot]) - LaneTravelCoordinate(self);
+}
 
-        float myS = LaneTravelCoordinate(self);
-        float otherS = LaneTravelCoordinate(o);
-        if (otherS > myS && (otherS - myS) < best) best = otherS - myS;
-    }
-    return best;
+// True when the last car in a lane is still within one headway of the
+// lane's entry point `entryDist`, so another car cannot join it yet
+static bool LaneEntryBlocked(const Intersection *n, int road, int lane, float entryDist) {
+    const LaneQueue *q = &n->queues[road][lane];
+    if (q->count == 0) return false;
+    float rear = DistanceFromNode(q->indices[q->rear]);
+    float gap = (lane == 0) ? rear - entryDist : entryDist - rear; // exit lanes run outward
+    return gap < CAR_LEN + minHeadway;
 }
 
 
+// Latency metrics
+// Each car is stamped when it enters an approach lane (spawn or hand-off)
+// and when it first comes to a halt there. When it crosses into the box its
+// wait (entry to crossing) and queue delay (halt to crossing, 0 if it never
+// stopped) go into that road/lane's histograms, aggregated over every
+// intersection. Spawns also record the generator-emit to spawn latency of
+// records that carry an emit timestamp.
+//
+// Histograms are HDR-style log-linear over whole milliseconds: exact below
+// HIST_LINEAR ms, then HIST_SUB buckets per power of two (about 3% error),
+// so recording is O(1) and percentiles are one pass over a fixed array.
 
-// Spawn vehicle
-static void SpawnVehicle(int road, int lane, const char *plateOpt) {
-    for(int i=0;i<MAX_VEH;i++){
-        if(!vehicles[i].active){
-            vehicles[i].active=true;
-            vehicles[i].road=road;
-            vehicles[i].lane=lane;
-            if(plateOpt) strncpy(vehicles[i].plate,plateOpt,sizeof(vehicles[i].plate));
-            else GenerateVehicleNumber(vehicles[i].plate);
-            vehicles[i].plate[sizeof(vehicles[i].plate)-1]='\0';
+#define HIST_LINEAR 64
+#define HIST_SUB 32
+#define HIST_BUCKETS (HIST_LINEAR + 26 * HIST_SUB) // up to 2^32 ms
+#define THROUGHPUT_WINDOW 60                        // seconds of per-second crossing counts
 
-            float lateral = LaneLateralOffset(road,lane);
-            switch(road){
-                case 0: vehicles[i].x=centerX+lateral; vehicles[i].y=-40; break;
-                case 1: vehicles[i].x=centerX+lateral; vehicles[i].y=screenH+40; break;
-                case 2: vehicles[i].x=screenW+40; vehicles[i].y=centerY+lateral; break;
-                case 3: vehicles[i].x=-40; vehicles[i].y=centerY+lateral; break;
-            }
-            SetLaneSpeed(&vehicles[i], 120.0f);
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint32_t max;            // ms
+    double sum;              // ms, for the mean
+} LatencyHistogram;
 
-            // enqueue vehicle in the lane queue
-            Enqueue(&laneQueues[road][lane], i);
-            break;
+typedef struct {
+    LatencyHistogram wait[4][3];
+    LatencyHistogram queueDelay[4][3];
+    LatencyHistogram ingest;                       // generator emit -> spawn, wall clock
+    long crossings[4][3];
+    long dropped[4][3];                            // arrivals lost to --max-vehicles
+    int recent[THROUGHPUT_WINDOW][4][3];           // crossings per second, ring by second
+    long recentSecond;                             // second of simTime recent[] ends at
+} SimMetrics;
+
+static SimMetrics metrics;
+static double simTime = 0.0; // simulated seconds since start
+
+static int HistogramBucket(uint32_t ms) {
+    if (ms < HIST_LINEAR) return (int)ms;
+    int msb = 31 - __builtin_clz(ms);
+    int shift = msb - 5;
+    return HIST_LINEAR + (msb - 6) * HIST_SUB + (int)((ms >> shift) - HIST_SUB);
+}
+
+// Largest value that lands in bucket b
+static uint32_t HistogramBucketMax(int b) {
+    if (b < HIST_LINEAR) return (uint32_t)b;
+    int shift = (b - HIST_LINEAR) / HIST_SUB + 1;
+    uint64_t lo = (uint64_t)(HIST_SUB + (b - HIST_LINEAR) % HIST_SUB) << shift;
+    return (uint32_t)(lo + ((uint64_t)1 << shift) - 1);
+}
+
+static void HistogramRecord(LatencyHistogram *h, double seconds) {
+    double ms = seconds * 1000.0;
+    uint32_t v = (ms <= 0.0) ? 0 : (ms >= 4294967295.0) ? UINT32_MAX : (uint32_t)(ms + 0.5);
+    h->counts[HistogramBucket(v)]++;
+    h->total++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+}
+
+static void HistogramMerge(LatencyHistogram *into, const LatencyHistogram *h) {
+    for (int b = 0; b < HIST_BUCKETS; b++) into->counts[b] += h->counts[b];
+    into->total += h->total;
+    into->sum += h->sum;
+    if (h->max > into->max) into->max = h->max;
+}
+
+typedef struct {
+    long count;
+    float p50, p95, p99, max, mean; // seconds
+} LatencySummary;
+
+static LatencySummary SummarizeHistogram(const LatencyHistogram *h) {
+    LatencySummary out = {(long)h->total, 0, 0, 0, h->max / 1000.0f, 0};
+    if (h->total == 0) return out;
+    out.mean = (float)(h->sum / h->total / 1000.0);
+    const double ranks[3] = {0.50, 0.95, 0.99};
+    float *dest[3] = {&out.p50, &out.p95, &out.p99};
+    uint64_t seen = 0;
+    int k = 0;
+    for (int b = 0; b < HIST_BUCKETS && k < 3; b++) {
+        seen += h->counts[b];
+        while (k < 3 && seen >= (uint64_t)(ranks[k] * h->total + 0.5) && seen > 0) {
+            uint32_t v = HistogramBucketMax(b);
+            *dest[k++] = ((v < h->max) ? v : h->max) / 1000.0f;
         }
     }
+    return out;
 }
 
+// Move the per-second throughput ring up to the current second, clearing skipped seconds
+static void AdvanceThroughputWindow(void) {
+    long now = (long)simTime;
+    if (now == metrics.recentSecond) return;
+    long from = metrics.recentSecond + 1;
+    if (now - from >= THROUGHPUT_WINDOW) from = now - THROUGHPUT_WINDOW + 1;
+    for (long t = from; t <= now; t++)
+        memset(metrics.recent[t % THROUGHPUT_WINDOW], 0, sizeof(metrics.recent[0]));
+    metrics.recentSecond = now;
+}
 
-// Intersection transitions
+// Crossings per minute over the last THROUGHPUT_WINDOW seconds (or since start)
+static float LaneThroughput(int road, int lane) {
+    AdvanceThroughputWindow();
+    long sum = 0;
+    for (int t = 0; t < THROUGHPUT_WINDOW; t++) sum += metrics.recent[t][road][lane];
+    double span = (simTime < THROUGHPUT_WINDOW) ? simTime : THROUGHPUT_WINDOW;
+    return (span > 0.0) ? (float)(sum * 60.0 / span) : 0.0f;
+}
 
-static Vector2 Lane0SpawnPoint(int road) {
-    Vector2 pos={(float)centerX,(float)centerY};
-    const float exitOffset=CAR_LEN;
-    float lateral=LaneLateralOffset(road,0);
-    switch(road){
-        case 0: pos.x=centerX+lateral; pos.y=centerY-roadWidth/2-exitOffset; break;
-        case 1: pos.x=centerX+lateral; pos.y=centerY+roadWidth/2+exitOffset; break;
-        case 2: pos.x=centerX+roadWidth/2+exitOffset; pos.y=centerY+lateral; break;
-        case 3: pos.x=centerX-roadWidth/2-exitOffset; pos.y=centerY+lateral; break;
+typedef struct {
+    LatencySummary wait, queueDelay;
+    long crossings, dropped;
+    float throughput;         // crossings per minute
+} LaneMetrics;
+
+// Lane (road, lane); road < 0 sums every approach lane
+static LaneMetrics SummarizeLane(int road, int lane) {
+    LaneMetrics m = {0};
+    if (road >= 0) {
+        m.wait = SummarizeHistogram(&metrics.wait[road][lane]);
+        m.queueDelay = SummarizeHistogram(&metrics.queueDelay[road][lane]);
+        m.crossings = metrics.crossings[road][lane];
+        m.dropped = metrics.dropped[road][lane];
+        m.throughput = LaneThroughput(road, lane);
+        return m;
+    }
+    static LatencyHistogram wait, queueDelay; // ~7 KB each, keep them off the stack
+    memset(&wait, 0, sizeof(wait));
+    memset(&queueDelay, 0, sizeof(queueDelay));
+    for (int r = 0; r < 4; r++) {
+        for (int l = 1; l < 3; l++) {
+            HistogramMerge(&wait, &metrics.wait[r][l]);
+            HistogramMerge(&queueDelay, &metrics.queueDelay[r][l]);
+            m.crossings += metrics.crossings[r][l];
+            m.dropped += metrics.dropped[r][l];
+            m.throughput += LaneThroughput(r, l);
+        }
     }
-    return pos;
+    m.wait = SummarizeHistogram(&wait);
+    m.queueDelay = SummarizeHistogram(&queueDelay);
+    return m;
+}
+
+// Vehicle i, a lane leader on an approach lane, is crossing the stop line
+static void RecordCrossing(int i) {
+    int road = vehicles.road[i], lane = vehicles.lane[i];
+    double halt = vehicles.haltTime[i];
+    HistogramRecord(&metrics.wait[road][lane], simTime - vehicles.entryTime[i]);
+    HistogramRecord(&metrics.queueDelay[road][lane], (halt < 0.0) ? 0.0 : simTime - halt);
+    metrics.crossings[road][lane]++;
+    AdvanceThroughputWindow();
+    metrics.recent[metrics.recentSecond % THROUGHPUT_WINDOW][road][lane]++;
+}
+
+// Vehicle i has just entered an approach lane
+static void StampLaneEntry(int i) {
+    vehicles.entryTime[i] = simTime;
+    vehicles.haltTime[i] = -1.0;
+}
+
+// Stamp the first halt of an approach lane car (lane 0 is the exit lane)
+static inline void StampHalt(int i) {
+    if (vehicles.lane[i] != 0 && vehicles.haltTime[i] < 0.0 && vehicles.vx[i] == 0.0f && vehicles.vy[i] == 0.0f)
+        vehicles.haltTime[i] = simTime;
+}
+
+
+
+// Called with each car SpawnVehicle puts on a lane (the event engine's hook)
+static void (*spawnHook)(int i) = NULL;
+
+// Spawn vehicle on an approach lane of intersection `node`
+static void SpawnVehicle(int node, int road, int lane, const char *plateOpt) {
+    int i = AllocVehicleSlot();
+    if (i < 0) { droppedSpawns++; metrics.dropped[road][lane]++; return; } // pool at --max-vehicles
+
+    Intersection *n = &nodes[node];
+    vehicles.node[i]=(unsigned short)node;
+    vehicles.road[i]=road;
+    vehicles.lane[i]=lane;
+    char *plate = vehicles.plate[i];
+    if(plateOpt) strncpy(plate,plateOpt,sizeof(vehicles.plate[i]));
+    else { memset(plate,0,sizeof(vehicles.plate[i])); GenerateVehicleNumber(plate); } // no stale bytes in digests, traces, checkpoints
+    plate[sizeof(vehicles.plate[i])-1]='\0';
+
+    Vector2 pos = LanePoint(n, road, lane, ApproachEntryDistance(n, road));
+    vehicles.x[i]=pos.x; vehicles.y[i]=pos.y;
+    SetLaneSpeed(i, 120.0f);
+    StampLaneEntry(i);
+
+    // enqueue vehicle in the lane queue
+    if (!JoinLane(n, road, lane, i)) { droppedSpawns++; metrics.dropped[road][lane]++; return; }
+    totalSpawned++;
+    if (spawnHook) spawnHook(i);
 }
 
+
+// Intersection transitions
+
 static int RoadLeft(int road){ static const int map[4]={3,2,0,1}; return map[road&3]; }
 static int RoadRight(int road){ static const int map[4]={2,3,1,0}; return map[road&3]; }
 static int RoadOpposite(int road){ static const int map[4]={1,0,3,2}; return map[road&3]; }
 
-static void TransitionVehicleThroughIntersection(Vehicle *v) {
-    int originRoad=v->road;
-    int originLane=v->lane;
-
-    // remove from queue if L2
-    if(originLane==1) Dequeue(&laneQueues[originRoad][originLane]);
+// Move a lane leader that reached the box onto an exit lane. Returns false
+// (and leaves it in place) while that exit lane is backed up to the box.
+static bool TransitionVehicleThroughIntersection(int i) {
+    Intersection *n=&nodes[vehicles.node[i]];
+    int originRoad=vehicles.road[i];
+    int originLane=vehicles.lane[i];
 
     int destRoad;
     if(originLane==2) destRoad=RoadLeft(originRoad);
-    else destRoad=(GetRandomValue(0,1)==0)?RoadOpposite(originRoad):RoadRight(originRoad);
+    else destRoad=(RngRange(&routingRng,0,1)==0)?RoadOpposite(originRoad):RoadRight(originRoad);
+
+    const float exitOffset=roadWidth/2+CAR_LEN;
+    if(LaneEntryBlocked(n,destRoad,0,exitOffset)) return false;
 
-    v->road=destRoad;
-    v->lane=0;
-    Vector2 pos=Lane0SpawnPoint(destRoad);
-    v->x=pos.x; v->y=pos.y;
-    SetLaneSpeed(v, VEH_SPEED);
+    RecordCrossing(i);
+
+    LeaveLane(n, originRoad, originLane, i);
+
+    vehicles.road[i]=destRoad;
+    vehicles.lane[i]=0;
+    Vector2 pos=LanePoint(n,destRoad,0,exitOffset);
+    vehicles.x[i]=pos.x; vehicles.y[i]=pos.y;
+    SetLaneSpeed(i, vehSpeed);
+
+    // exit lane entry point is behind every car already leaving on it
+    JoinLane(n, destRoad, 0, i);
+    return true;
+}
 
-    // enqueue in new lane if L2
-    if(v->lane==1) Enqueue(&laneQueues[destRoad][v->lane], v-vehicles);
+// Move an exit lane leader that reached the end of its lane onto an approach
+// lane of the neighbouring intersection (L2, or L3 for a third of cars).
+// Returns false while that lane is queued back to its entry point.
+static bool HandOffVehicle(int i, int to) {
+    Intersection *from=&nodes[vehicles.node[i]], *dest=&nodes[to];
+    int road=vehicles.road[i];
+    int destRoad=RoadOpposite(road);
+    int destLane=(RngRange(&routingRng,0,2)==0)?2:1;
+    float entry=ApproachEntryDistance(dest,destRoad);
+    if(LaneEntryBlocked(dest,destRoad,destLane,entry)) return false;
+
+    LeaveLane(from, road, 0, i);
+
+    vehicles.node[i]=(unsigned short)to;
+    vehicles.road[i]=destRoad;
+    vehicles.lane[i]=destLane;
+    Vector2 pos=LanePoint(dest,destRoad,destLane,entry);
+    vehicles.x[i]=pos.x; vehicles.y[i]=pos.y;
+    SetLaneSpeed(i, vehSpeed);
+    StampLaneEntry(i);
+
+    JoinLane(dest, destRoad, destLane, i);
+    return true;
 }
 
+// Undo this tick's step for a car that may not move on yet
+static void HoldVehicle(int i, float dt) {
+    vehicles.x[i]-=vehicles.vx[i]*dt;
+    vehicles.y[i]-=vehicles.vy[i]*dt;
+    vehicles.vx[i]=vehicles.vy[i]=0.0f;
+    StampHalt(i);
+}
 
 
-static void UpdateVehicles(float dt) {
-    float stopOffset = roadWidth / 2.0f + 15.0f; // stop line distance to center
-    float boxMinX = centerX - roadWidth / 2.0f;
-    float boxMaxX = centerX + roadWidth / 2.0f;
-    float boxMinY = centerY - roadWidth / 2.0f;
-    float boxMaxY = centerY + roadWidth / 2.0f;
-    for (int i = 0; i < MAX_VEH; i++) {
-        Vehicle *v = &vehicles[i];
-        if (!v->active) continue;
-
-        bool approachLane = (v->lane != 0);
-        bool stop = approachLane && ShouldStop(v);
-
-        // car-following headway check (do not run into the vehicle ahead)
-        float gap = LeadGap(v);
-        bool tooClose = gap < (CAR_LEN + MIN_HEADWAY);
-
-        if (approachLane) {
-            float s = 0.0f;
-            float stopLineS = 0.0f;
-            float desiredS_stop = 0.0f;
-            float desiredS = 0.0f;
-
-            switch (v->road) {
-                case 0: // top -> down (y increasing)
-                    s = v->y;
-                    stopLineS = centerY - stopOffset;
-                    desiredS_stop = stopLineS - (CAR_LEN * 0.5f);
-                    break;
-                case 1: // bottom -> up (y decreasing)
-                    s = -v->y;
-                    stopLineS = -(centerY + stopOffset);
-                    desiredS_stop = stopLineS - (CAR_LEN * 0.5f);
-                    break;
-                case 2: // right -> left (x decreasing)
-                    s = -v->x;
-                    stopLineS = -(centerX + stopOffset);
-                    desiredS_stop = stopLineS - (CAR_LEN * 0.5f);
-                    break;
-                case 3: // left -> right (x increasing)
-                    s = v->x;
-                    stopLineS = centerX - stopOffset;
-                    desiredS_stop = stopLineS - (CAR_LEN * 0.5f);
-                    break;
-            }
 
-            desiredS = desiredS_stop;
-            if (gap < 1e8f) {
-                float leaderS = s + gap;
-                float spacingCenter = (CAR_LEN + MIN_HEADWAY);
-                float desiredBehindLeader = leaderS - spacingCenter;
-                if (desiredBehindLeader < desiredS) desiredS = desiredBehindLeader;
-            }
+// Pick velocity for vehicle i from the light, stop line and the car ahead.
+// May snap a car stopping at the line onto its exact stop position.
+static void ControlVehicle(int i, float stopOffset) {
+    bool approachLane = (vehicles.lane[i] != 0);
+    bool stop = approachLane && ShouldStop(i);
 
-            const float eps = 1.0f;
-            if (stop) {
-                if (tooClose) {
-                    v->vx = 0;
-                    v->vy = 0;
-                } else if (s < desiredS - eps) {
-                    SetLaneSpeed(v, VEH_SPEED);
-                } else if (s <= desiredS + eps) {
-                    v->vx = 0;
-                    v->vy = 0;
-                    switch (v->road) {
-                        case 0: v->y = desiredS; break;
-                        case 1: v->y = -desiredS; break;
-                        case 2: v->x = -desiredS; break;
-                        case 3: v->x = desiredS; break;
-                    }
-                } else {
-                    SetLaneSpeed(v, VEH_SPEED);
-                }
-            } else {
-                if (tooClose) {
-                    v->vx = 0;
-                    v->vy = 0;
-                } else {
-                    SetLaneSpeed(v, VEH_SPEED);
-                }
-            }
+    // car-following headway check (do not run into the vehicle ahead)
+    float gap = LeadGap(i);
+    bool tooClose = gap < (CAR_LEN + minHeadway);
+
+    if (!approachLane || !stop) {
+        if (tooClose) {
+            vehicles.vx[i] = 0;
+            vehicles.vy[i] = 0;
         } else {
-            if (tooClose) {
-                v->vx = 0;
-                v->vy = 0;
-            } else {
-                SetLaneSpeed(v, VEH_SPEED);
-            }
+            SetLaneSpeed(i, vehSpeed);
         }
+        return;
+    }
 
-        v->x += v->vx * dt;
-        v->y += v->vy * dt;
+    const Intersection *n = &nodes[vehicles.node[i]];
+    float s = 0.0f;
+    float stopLineS = 0.0f;
+    float desiredS = 0.0f;
 
-        if (approachLane && v->x > boxMinX && v->x < boxMaxX && v->y > boxMinY && v->y < boxMaxY) {
-            TransitionVehicleThroughIntersection(v);
-            continue;
+    switch (vehicles.road[i]) {
+        case 0: // top -> down (y increasing)
+            s = vehicles.y[i];
+            stopLineS = n->cy - stopOffset;
+            break;
+        case 1: // bottom -> up (y decreasing)
+            s = -vehicles.y[i];
+            stopLineS = -(n->cy + stopOffset);
+            break;
+        case 2: // right -> left (x decreasing)
+            s = -vehicles.x[i];
+            stopLineS = -(n->cx + stopOffset);
+            break;
+        case 3: // left -> right (x increasing)
+            s = vehicles.x[i];
+            stopLineS = n->cx - stopOffset;
+            break;
+    }
+
+    desiredS = stopLineS - (CAR_LEN * 0.5f);
+    if (gap < 1e8f) {
+        float leaderS = s + gap;
+        float spacingCenter = (CAR_LEN + minHeadway);
+        float desiredBehindLeader = leaderS - spacingCenter;
+        if (desiredBehindLeader < desiredS) desiredS = desiredBehindLeader;
+    }
+
+    const float eps = 1.0f;
+    if (tooClose) {
+        vehicles.vx[i] = 0;
+        vehicles.vy[i] = 0;
+    } else if (s < desiredS - eps) {
+        SetLaneSpeed(i, vehSpeed);
+    } else if (s <= desiredS + eps) {
+        vehicles.vx[i] = 0;
+        vehicles.vy[i] = 0;
+        switch (vehicles.road[i]) {
+            case 0: vehicles.y[i] = desiredS; break;
+            case 1: vehicles.y[i] = -desiredS; break;
+            case 2: vehicles.x[i] = -desiredS; break;
+            case 3: vehicles.x[i] = desiredS; break;
+        }
+    } else {
+        SetLaneSpeed(i, vehSpeed);
+    }
+}
+
+// Control every car in one lane, leader first
+static void ControlLane(const LaneQueue *q, float stopOffset) {
+    int slot = q->front;
+    for (int k = 0; k < q->count; k++) {
+        ControlVehicle(q->indices[slot], stopOffset);
+        StampHalt(q->indices[slot]);
+        if (++slot == q->capacity) slot = 0;
+    }
+}
+
+// Only a lane's leader can have reached the box (approach lanes) or the end
+// of the lane (exit lanes), so each lane checks its front until one has not
+static void AdvanceLaneLeaders(int node, float dt) {
+    Intersection *n = &nodes[node];
+    float half = roadWidth / 2.0f;
+    for (int r = 0; r < 4; r++) {
+        for (int l = 1; l < 3; l++) {
+            LaneQueue *q = &n->queues[r][l];
+            while (q->count > 0) {
+                int i = q->indices[q->front];
+                float dx = vehicles.x[i] - n->cx, dy = vehicles.y[i] - n->cy;
+                if (dx <= -half || dx >= half || dy <= -half || dy >= half) break;
+                if (!TransitionVehicleThroughIntersection(i)) { HoldVehicle(i, dt); break; }
+            }
         }
 
-        if (v->x < -200 || v->x > screenW + 200 || v->y < -200 || v->y > screenH + 200) {
-            v->active = false;
+        LaneQueue *q = &n->queues[r][0];
+        float exitDist = ExitDistance(n, r);
+        while (q->count > 0) {
+            int i = q->indices[q->front];
+            if (DistanceFromNode(i) < exitDist) break;
+            if (n->neighbor[r] >= 0) {
+                if (!HandOffVehicle(i, n->neighbor[r])) { HoldVehicle(i, dt); break; }
+            } else {
+                // leaving the network
+                LeaveLane(n, r, 0, i);
+                FreeVehicleSlot(i);
+                totalExited++;
+            }
         }
     }
 }
 
-static void DrawRoads(void) {
-    ClearBackground((Color){220, 226, 230, 255});
+// Pool slots integrated per task. A multiple of the widest SIMD step, so the
+// kernel's vector/scalar split, and therefore the results, do not depend
+// on how slots are divided between threads.
+#define INTEGRATE_CHUNK 4096
+
+typedef struct {
+    float stopOffset;
+    float dt;
+} VehicleStepArgs;
+
+// Lanes [begin, end), numbered node*12 + road*3 + lane
+static void ControlLanesTask(int begin, int end, void *arg) {
+    const VehicleStepArgs *a = arg;
+    for (int t = begin; t < end; t++)
+        ControlLane(&nodes[t / 12].queues[0][0] + t % 12, a->stopOffset);
+}
+
+static void IntegrateTask(int begin, int end, void *arg) {
+    const VehicleStepArgs *a = arg;
+    int first = begin * INTEGRATE_CHUNK;
+    int last = end * INTEGRATE_CHUNK;
+    if (last > vehicleHighWater) last = vehicleHighWater;
+    IntegratePositions(vehicles.x + first, vehicles.y + first, vehicles.vx + first, vehicles.vy + first,
+                       last - first, a->dt);
+}
+
+// Three passes, each partitioned by intersection and lane so no pass scans
+// the whole pool for one junction: car-following control walks each lane
+// queue in travel order, the vectorized kernel integrates the pool, then
+// only lane leaders are checked for crossing the box or leaving their lane.
+// The first two passes touch only each lane's (or chunk's) own vehicles and
+// run on the thread pool; the third moves cars between lanes and stays a
+// serial commit in node order, so results match a single-threaded run.
+static void UpdateVehicles(float dt) {
+    VehicleStepArgs args = {roadWidth / 2.0f + 15.0f, dt}; // stop line distance to center
+
+    {
+        PROFILE_ZONE(PROF_CONTROL);
+        ParallelFor(nodeCount * 12, 64, ControlLanesTask, &args);
+    }
+    {
+        PROFILE_ZONE(PROF_INTEGRATE);
+        ParallelFor((vehicleHighWater + INTEGRATE_CHUNK - 1) / INTEGRATE_CHUNK, 1, IntegrateTask, &args);
+    }
+    PROFILE_ZONE(PROF_ADVANCE);
+    for (int n = 0; n < nodeCount; n++) AdvanceLaneLeaders(n, dt);
+}
+
+#ifndef HEADLESS
+// Render snapshots
+// The UI build runs the simulation on its own thread. After each tick it
+// copies what the UI draws into a SimSnapshot and publishes it through a
+// triple buffer: the simulation fills its back buffer and swaps it into
+// `snapshotReady`; the render loop swaps the ready buffer for its front
+// buffer when a fresh one is there. Neither side ever waits for the other,
+// and a snapshot is never written while it is being drawn.
+
+#define SNAPSHOT_FRESH 4 // flag in snapshotReady: not yet taken by the renderer
+
+typedef struct {
+    double tickStart;          // GetTime() when prevX/prevY held; x/y hold SIM_TICK later
+    int screenW, screenH;      // layout the tick ran with
+    int centerX, centerY;
+    int count;                 // vehicles in the arrays below
+    int capacity;
+    float *x, *y;              // position at the end of the tick
+    float *prevX, *prevY;      // position at its start
+    unsigned char *road, *lane;
+    char (*plate)[16];
+    int currentGreen;
+    float phaseTimer, greenDuration;
+    bool al2PriorityActive;
+    int laneCounts[4][3];
+    float satTimer[4][3];
+    long droppedSpawns;
+    int maxVehicles;
+    LaneMetrics laneMetrics[4][3]; // approach lanes (L2, L3) only
+    LaneMetrics allLanes;
+    LatencySummary ingest;
+} SimSnapshot;
+
+static SimSnapshot snapshots[3];
+static _Atomic int snapshotReady = 0;  // buffer index | SNAPSHOT_FRESH
+static int snapshotBack = 1;           // simulation thread's buffer
+static int snapshotFront = 2;          // render thread's buffer
+static float *prevX = NULL, *prevY = NULL; // positions before the current tick
+static int prevCapacity = 0;
+
+// Simulation thread: remember positions before a tick, for interpolation
+static void SavePreviousPositions(void) {
+    if (prevCapacity < vehicleCapacity) {
+        if (!GrowArray((void **)&prevX, sizeof(float), vehicleCapacity) ||
+            !GrowArray((void **)&prevY, sizeof(float), vehicleCapacity)) return;
+        prevCapacity = vehicleCapacity;
+    }
+    memcpy(prevX, vehicles.x, (size_t)vehicleHighWater * sizeof(float));
+    memcpy(prevY, vehicles.y, (size_t)vehicleHighWater * sizeof(float));
+}
+
+// Simulation thread: copy the drawable state into the back buffer and publish it
+static void PublishSnapshot(double tickStart) {
+    PROFILE_ZONE(PROF_PUBLISH);
+    SimSnapshot *s = &snapshots[snapshotBack];
+    if (s->capacity < vehicleHighWater) {
+        int cap = vehicleCapacity;
+        if (!GrowArray((void **)&s->x, sizeof(float), cap) || !GrowArray((void **)&s->y, sizeof(float), cap) ||
+            !GrowArray((void **)&s->prevX, sizeof(float), cap) || !GrowArray((void **)&s->prevY, sizeof(float), cap) ||
+            !GrowArray((void **)&s->road, sizeof(unsigned char), cap) ||
+            !GrowArray((void **)&s->lane, sizeof(unsigned char), cap) ||
+            !GrowArray((void **)&s->plate, sizeof(s->plate[0]), cap))
+            return; // keep showing the previous snapshot
+        s->capacity = cap;
+    }
+
+    int k = 0;
+    for (int i = 0; i < vehicleHighWater; i++) {
+        if (!IsVehicleActive(i)) continue;
+        s->x[k] = vehicles.x[i];
+        s->y[k] = vehicles.y[i];
+        bool known = (i < prevCapacity);
+        s->prevX[k] = known ? prevX[i] : vehicles.x[i];
+        s->prevY[k] = known ? prevY[i] : vehicles.y[i];
+        s->road[k] = vehicles.road[i];
+        s->lane[k] = vehicles.lane[i];
+        memcpy(s->plate[k], vehicles.plate[i], sizeof(s->plate[k]));
+        k++;
+    }
+    s->count = k;
+
+    const Intersection *n = &nodes[0];
+    s->tickStart = tickStart;
+    s->screenW = screenW;
+    s->screenH = screenH;
+    s->centerX = centerX;
+    s->centerY = centerY;
+    s->currentGreen = n->currentGreen;
+    s->phaseTimer = n->phaseTimer;
+    s->greenDuration = n->greenDuration;
+    s->al2PriorityActive = n->al2PriorityActive;
+    memcpy(s->laneCounts, n->occupancy, sizeof(s->laneCounts));
+    memcpy(s->satTimer, n->satTimer, sizeof(s->satTimer));
+    s->droppedSpawns = droppedSpawns;
+    s->maxVehicles = vehicleMaxCapacity;
+    for (int r = 0; r < 4; r++)
+        for (int l = 1; l < 3; l++) s->laneMetrics[r][l] = SummarizeLane(r, l);
+    s->allLanes = SummarizeLane(-1, 0);
+    s->ingest = SummarizeHistogram(&metrics.ingest);
+
+    snapshotBack = atomic_exchange(&snapshotReady, snapshotBack | SNAPSHOT_FRESH) & 3;
+}
+
+// Render thread: the newest published snapshot (the same one again if none is newer)
+static const SimSnapshot *AcquireSnapshot(void) {
+    if (atomic_load(&snapshotReady) & SNAPSHOT_FRESH)
+        snapshotFront = atomic_exchange(&snapshotReady, snapshotFront) & 3;
+    return &snapshots[snapshotFront];
+}
 
+static void DrawRoads(const SimSnapshot *s) {
     // Vertical road (A/B)
-    DrawRectangle(centerX - roadWidth/2, 0, roadWidth, screenH, roadColor);
+    DrawRectangle(s->centerX - roadWidth/2, 0, roadWidth, s->screenH, roadColor);
     // Horizontal road (C/D)
-    DrawRectangle(0, centerY - roadWidth/2, screenW, roadWidth, roadColor);
+    DrawRectangle(0, s->centerY - roadWidth/2, s->screenW, roadWidth, roadColor);
 
     // Lane lines
     for (int i = 1; i < 3; i++) {
-        DrawLine(centerX - roadWidth/2 + laneWidth * i, 0,
-                 centerX - roadWidth/2 + laneWidth * i, screenH, laneColor);
-        DrawLine(0, centerY - roadWidth/2 + laneWidth * i,
-                 screenW, centerY - roadWidth/2 + laneWidth * i, laneColor);
+        DrawLine(s->centerX - roadWidth/2 + laneWidth * i, 0,
+                 s->centerX - roadWidth/2 + laneWidth * i, s->screenH, laneColor);
+        DrawLine(0, s->centerY - roadWidth/2 + laneWidth * i,
+                 s->screenW, s->centerY - roadWidth/2 + laneWidth * i, laneColor);
     }
 
     // Intersection box
-    DrawRectangleLines(centerX - roadWidth/2, centerY - roadWidth/2, roadWidth, roadWidth, WHITE);
+    DrawRectangleLines(s->centerX - roadWidth/2, s->centerY - roadWidth/2, roadWidth, roadWidth, WHITE);
 }
 
-static void DrawLaneMarkers(void) {
+static void DrawLaneMarkers(const SimSnapshot *s) {
     // Label lanes near the stop line for each approach
     const char *laneNames[3] = {"L1", "L2", "L3"};
     int textSize = 16;
@@ -410,64 +1387,64 @@ static void DrawLaneMarkers(void) {
 
     // Road A (top), lanes stacked horizontally across road width
     for (int lane = 0; lane < 3; lane++) {
-        int lx = centerX + (int)LaneLateralOffset(0, lane) - 10;
-        int ly = centerY - roadWidth/2 - 40;
+        int lx = s->centerX + (int)LaneLateralOffset(0, lane) - 10;
+        int ly = s->centerY - roadWidth/2 - 40;
         DrawText(laneNames[lane], lx, ly, textSize, BLACK);
     }
 
     // Road B (bottom)
     for (int lane = 0; lane < 3; lane++) {
-        int lx = centerX + (int)LaneLateralOffset(1, lane) - 10;
-        int ly = centerY + roadWidth/2 + 20;
+        int lx = s->centerX + (int)LaneLateralOffset(1, lane) - 10;
+        int ly = s->centerY + roadWidth/2 + 20;
         DrawText(laneNames[lane], lx, ly, textSize, BLACK);
     }
 
     // Road C (right)
     for (int lane = 0; lane < 3; lane++) {
-        int lx = centerX + roadWidth/2 + 20;
-        int ly = centerY + (int)LaneLateralOffset(2, lane) - textSize - gap;
+        int lx = s->centerX + roadWidth/2 + 20;
+        int ly = s->centerY + (int)LaneLateralOffset(2, lane) - textSize - gap;
         DrawText(laneNames[lane], lx, ly, textSize, BLACK);
     }
 
     // Road D (left)
     for (int lane = 0; lane < 3; lane++) {
-        int lx = centerX - roadWidth/2 - 40;
-        int ly = centerY + (int)LaneLateralOffset(3, lane) - textSize;
+        int lx = s->centerX - roadWidth/2 - 40;
+        int ly = s->centerY + (int)LaneLateralOffset(3, lane) - textSize;
         DrawText(laneNames[lane], lx, ly, textSize, BLACK);
     }
 }
 
-static void DrawLights(void) {
+static void DrawLights(const SimSnapshot *s) {
     const char *labels[4] = {"A", "B", "C", "D"};
     // Aligned close to each approach's stop line
     Vector2 pos[4] = {
-        { centerX - 25, centerY - roadWidth/2 - 110 }, // A top
-        { centerX - 25, centerY + roadWidth/2 + 20 },  // B bottom
-        { centerX + roadWidth/2 + 20, centerY - 25 },  // C right
-        { centerX - roadWidth/2 - 70, centerY - 25 }   // D left
+        { s->centerX - 25, s->centerY - roadWidth/2 - 110 }, // A top
+        { s->centerX - 25, s->centerY + roadWidth/2 + 20 },  // B bottom
+        { s->centerX + roadWidth/2 + 20, s->centerY - 25 },  // C right
+        { s->centerX - roadWidth/2 - 70, s->centerY - 25 }   // D left
     };
 
     for (int i = 0; i < 4; i++) {
         DrawRectangle(pos[i].x, pos[i].y, 50, 90, DARKGRAY);
         DrawRectangleLines(pos[i].x, pos[i].y, 50, 90, WHITE);
-        Color red = (i == currentGreen) ? (Color){80,80,80,255} : RED;
-        Color green = (i == currentGreen) ? GREEN : (Color){40,40,40,255};
+        Color red = (i == s->currentGreen) ? (Color){80,80,80,255} : RED;
+        Color green = (i == s->currentGreen) ? GREEN : (Color){40,40,40,255};
         DrawCircle(pos[i].x + 25, pos[i].y + 22, 12, red);
         DrawCircle(pos[i].x + 25, pos[i].y + 68, 12, green);
         DrawText(labels[i], pos[i].x + 18, pos[i].y + 44, 12, WHITE);
     }
 }
 
-static void DrawLaneLabels(void) {
-    DrawText("L1 incoming, L2 outgoing (obeys light), L3 free left-turn", 20, screenH - 60, 18, DARKGRAY);
-    DrawText("Only one road green at a time to avoid deadlock", 20, screenH - 35, 18, DARKGRAY);
+static void DrawLaneLabels(const SimSnapshot *s) {
+    DrawText("L1 incoming, L2 outgoing (obeys light), L3 free left-turn", 20, s->screenH - 60, 18, DARKGRAY);
+    DrawText("Only one road green at a time to avoid deadlock", 20, s->screenH - 35, 18, DARKGRAY);
 }
 
-static void DrawLaneAlerts(void) {
+static void DrawLaneAlerts(const SimSnapshot *s) {
     int y = 50; // push down to avoid overlapping the HUD header
     for (int r = 0; r < 4; r++) {
         for (int l = 0; l < 3; l++) {
-            if (laneSatTimer[r][l] > 0) {
+            if (s->satTimer[r][l] > 0) {
                 const char roadChar = 'A' + r;
                 DrawText(TextFormat("Lane %c L%d saturated (>=10 vehicles)", roadChar, l+1), 20, y, 18, RED);
                 y += 22;
@@ -476,138 +1453,2467 @@ static void DrawLaneAlerts(void) {
     }
 }
 
-static void DrawPriorityStatus(void) {
-    const char *message = al2PriorityActive ? "Priority condition ACTIVE" : "Priority condition inactive";
+static void DrawPriorityStatus(const SimSnapshot *s) {
+    const char *message = s->al2PriorityActive ? "Priority condition ACTIVE" : "Priority condition inactive";
     int fontSize = 20;
     int textWidth = MeasureText(message, fontSize);
-    int x = screenW - textWidth - 20;
+    int x = s->screenW - textWidth - 20;
     if (x < 20) x = 20;
-    Color color = al2PriorityActive ? GREEN : DARKGRAY;
+    Color color = s->al2PriorityActive ? GREEN : DARKGRAY;
     DrawText(message, x, 20, fontSize, color);
 }
 
-static void DrawVehicles(void) {
-    for (int i = 0; i < MAX_VEH; i++) {
-        if (!vehicles[i].active) continue;
-        Color c = (vehicles[i].lane == 1) ? ORANGE : SKYBLUE;
-        if (vehicles[i].lane == 2) c = LIME;
+// Static layers
+// Roads, lane lines, the box and the lane markers only change when the
+// window is resized, so they are drawn once into a world-sized render
+// texture and blitted each frame; the legend text is baked the same way.
+// Only lights, vehicles, alerts and the HUD are drawn from scratch.
+
+static RenderTexture2D roadLayer;
+static RenderTexture2D legendLayer;
+static int roadLayerW, roadLayerH;
+
+// Redraw the road layer if the snapshot's scene size differs from it
+static void UpdateRoadLayer(const SimSnapshot *s) {
+    if (roadLayer.id != 0 && roadLayerW == s->screenW && roadLayerH == s->screenH) return;
+    if (roadLayer.id != 0) UnloadRenderTexture(roadLayer);
+    roadLayerW = s->screenW;
+    roadLayerH = s->screenH;
+    roadLayer = LoadRenderTexture(roadLayerW, roadLayerH);
+    SetTextureFilter(roadLayer.texture, TEXTURE_FILTER_BILINEAR); // smooth when zoomed
+    BeginTextureMode(roadLayer);
+    ClearBackground(backgroundColor);
+    DrawRoads(s);
+    DrawLaneMarkers(s);
+    EndTextureMode();
+}
 
-        // Draw vehicle as a rounded car shape instead of a square box
-        float carW = CAR_WID;
-        float carL = CAR_LEN;
-        float px = vehicles[i].x - carW * 0.5f;
-        float py = vehicles[i].y - carL * 0.5f;
-        DrawRectangleRounded((Rectangle){px, py, carW, carL}, 0.35f, 6, c);
-        DrawRectangleRoundedLines((Rectangle){px, py, carW, carL}, 0.35f, 6, BLACK);
-        DrawText(vehicles[i].plate, (int)(px - 6), (int)(py - 14), 10, BLACK);
-    }
+// Render textures are stored bottom-up, hence the negative source height
+static void DrawLayer(RenderTexture2D layer, float x, float y) {
+    Rectangle src = {0, 0, (float)layer.texture.width, -(float)layer.texture.height};
+    DrawTextureRec(layer.texture, src, (Vector2){x, y}, WHITE);
 }
 
-// Read appended lines from vehicles.data in format PLATE:ROAD:LANE
-static void PollVehicleFile(void) {
-    FILE *f = fopen("vehicles.data", "r");
-    if (!f) return;
+static void LoadLegendLayer(void) {
+    SimSnapshot s = {.screenH = 60};
+    int w = MeasureText("L1 incoming, L2 outgoing (obeys light), L3 free left-turn", 18);
+    legendLayer = LoadRenderTexture(w + 20, 60);
+    BeginTextureMode(legendLayer);
+    ClearBackground((Color){backgroundColor.r, backgroundColor.g, backgroundColor.b, 0}); // text edges blend to the background
+    DrawLaneLabels(&s);
+    EndTextureMode();
+}
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    if (size < vehiclesFilePos) vehiclesFilePos = 0; // file truncated/rotated
-    fseek(f, vehiclesFilePos, SEEK_SET);
+static void UnloadStaticLayers(void) {
+    if (roadLayer.id != 0) UnloadRenderTexture(roadLayer);
+    UnloadRenderTexture(legendLayer);
+}
 
-    char line[256];
-    int spawned = 0;
-    while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\r\n")] = 0;
-        char plate[16];
-        char roadChar;
-        int lane;
-        if (sscanf(line, "%15[^:]:%c:%d", plate, &roadChar, &lane) != 3) continue;
-        int road = -1;
-        switch (roadChar) {
-            case 'A': road = 0; break;
-            case 'B': road = 1; break;
-            case 'C': road = 2; break;
-            case 'D': road = 3; break;
-        }
-        if (road < 0 || lane < 0 || lane > 2) continue;
-        if (lane == 0) continue; // lane 0 vehicles now only enter via intersection transitions
-        int before = LaneCount(road, lane);
-        if (before >= 10) laneSatTimer[road][lane] = 3.0f; // already saturated
+// Vehicle sprites
+// Every car is one textured quad cut from a small atlas holding a pre-drawn
+// rounded car per lane colour, so raylib batches all cars into a single
+// draw call instead of two rounded-rectangle meshes each. Plates are drawn
+// in a second pass (one font texture, one more batch) and only when zoomed
+// in far enough and few enough cars are in view for them to be legible.
+
+#define SPRITE_SCALE 2            // atlas texels per world pixel
+#define SPRITE_PAD 2              // transparent border around each cell
+#define PLATE_MIN_ZOOM 0.9f       // hide plates when zoomed out further
+#define PLATE_MAX_VISIBLE 400     // ...or when more cars than this are in view
+
+static RenderTexture2D carAtlas;
+static Camera2D camera = {{0, 0}, {0, 0}, 0.0f, 1.0f};
 
-        SpawnVehicle(road, lane, plate);
+typedef struct {
+    int sprites;                  // cars drawn this frame
+    int plates;                   // plates drawn this frame
+    int drawCalls;                // raylib draw calls issued by DrawVehicles
+} VehicleDrawStats;
+
+static VehicleDrawStats vehicleDrawStats;
+
+static Color LaneColor(int lane) {
+    return (lane == 1) ? ORANGE : (lane == 2) ? LIME : SKYBLUE;
+}
 
-        int after = LaneCount(road, lane);
-        if (after >= 10) laneSatTimer[road][lane] = 3.0f; // hit or stay saturated after spawn
-        if (++spawned >= MAX_SPAWNS_PER_TICK) break; // avoid burst spawning
+static Rectangle CarSpriteCell(int lane) {
+    float w = CAR_WID * SPRITE_SCALE, h = CAR_LEN * SPRITE_SCALE;
+    return (Rectangle){lane * (w + 2 * SPRITE_PAD) + SPRITE_PAD, SPRITE_PAD, w, h};
+}
+
+// Render the three car sprites once (needs the GL context, so after InitWindow)
+static void LoadCarAtlas(void) {
+    Rectangle last = CarSpriteCell(2);
+    carAtlas = LoadRenderTexture((int)(last.x + last.width) + SPRITE_PAD, (int)last.height + 2 * SPRITE_PAD);
+    SetTextureFilter(carAtlas.texture, TEXTURE_FILTER_BILINEAR);
+    BeginTextureMode(carAtlas);
+    ClearBackground(BLANK);
+    for (int lane = 0; lane < 3; lane++) {
+        Rectangle cell = CarSpriteCell(lane);
+        DrawRectangleRounded(cell, 0.35f, 6, LaneColor(lane));
+        DrawRectangleRoundedLines(cell, 0.35f, 6, BLACK);
     }
+    EndTextureMode();
+}
 
-    vehiclesFilePos = ftell(f);
-    fclose(f);
+// Mouse wheel zooms about the cursor
+static void UpdateCamera2D(void) {
+    float wheel = GetMouseWheelMove();
+    if (wheel == 0.0f) return;
+    Vector2 mouse = GetMousePosition();
+    camera.target = GetScreenToWorld2D(mouse, camera);
+    camera.offset = mouse;
+    camera.zoom *= (wheel > 0) ? 1.1f : 1.0f / 1.1f;
+    if (camera.zoom < 0.1f) camera.zoom = 0.1f;
+    if (camera.zoom > 4.0f) camera.zoom = 4.0f;
 }
 
-// Main loop
+// Car k `alpha` of the way through the snapshot's tick; a car that jumped
+// (spawned, crossed the box) is placed where it ended up
+static Vector2 SnapshotPosition(const SimSnapshot *s, int k, float alpha) {
+    const float maxStep = 16.0f;
+    float dx = s->x[k] - s->prevX[k], dy = s->y[k] - s->prevY[k];
+    if (dx > -maxStep && dx < maxStep && dy > -maxStep && dy < maxStep)
+        return (Vector2){s->prevX[k] + dx * alpha, s->prevY[k] + dy * alpha};
+    return (Vector2){s->x[k], s->y[k]};
+}
 
-int main(void) {
-    SetConfigFlags(FLAG_WINDOW_RESIZABLE|FLAG_VSYNC_HINT);
-    InitWindow(screenW,screenH,"Queue Simulator - Raylib UI");
-    SetTargetFPS(60);
+// Cars in the camera's view (call inside BeginMode2D)
+static void DrawVehicles(const SimSnapshot *s, float alpha) {
+    VehicleDrawStats stats = {0, 0, 0};
 
-    InitVehicles();
-    InitQueues(); // initialize lane queues
-    SetRandomSeed((unsigned int)GetTime());
+    // world-space view, padded by a car length so cars at the edge are not cut
+    Vector2 lo = GetScreenToWorld2D((Vector2){0, 0}, camera);
+    Vector2 hi = GetScreenToWorld2D((Vector2){(float)s->screenW, (float)s->screenH}, camera);
+    lo.x -= CAR_LEN; lo.y -= CAR_LEN; hi.x += CAR_LEN; hi.y += CAR_LEN;
 
-    currentGreenDuration=calculateGreenDuration();
+    // the texture is a render target, so it is stored upside down: flip the source
+    Rectangle src[3];
+    for (int lane = 0; lane < 3; lane++) {
+        src[lane] = CarSpriteCell(lane);
+        src[lane].height = -src[lane].height;
+    }
+    Vector2 origin = {CAR_WID * 0.5f, CAR_LEN * 0.5f};
 
-    while(!WindowShouldClose()){
-        float dt=GetFrameTime();
-
-        // handle window resize
-        screenW=GetScreenWidth(); screenH=GetScreenHeight();
-        int newCenterX=screenW/2; int newCenterY=screenH/2;
-        int dx=newCenterX-centerX, dy=newCenterY-centerY;
-        if(dx!=0||dy!=0){
-            for(int i=0;i<MAX_VEH;i++)
-                if(vehicles[i].active){ vehicles[i].x+=dx; vehicles[i].y+=dy; }
-        }
-        centerX=newCenterX; centerY=newCenterY;
-
-        // pull new vehicles from file
-        PollVehicleFile();
-
-        // update AL2 priority
-        UpdateAl2PriorityState();
-
-        // traffic light logic
-        if(al2PriorityActive){ currentGreen=0; phaseTimer=0.0f; }
-        else{
-            phaseTimer+=dt;
-            if(phaseTimer>=currentGreenDuration){
-                phaseTimer=0.0f;
-                currentGreen=(currentGreen+1)%4;
-                currentGreenDuration=calculateGreenDuration();
-            }
+    for (int k = 0; k < s->count; k++) {
+        Vector2 p = SnapshotPosition(s, k, alpha);
+        if (p.x < lo.x || p.x > hi.x || p.y < lo.y || p.y > hi.y) continue;
+
+        float rotation = (s->road[k] >= 2) ? 90.0f : 0.0f; // C/D run horizontally
+        DrawTexturePro(carAtlas.texture, src[s->lane[k]], (Rectangle){p.x, p.y, CAR_WID, CAR_LEN}, origin, rotation, WHITE);
+        stats.sprites++;
+    }
+
+    if (camera.zoom >= PLATE_MIN_ZOOM && stats.sprites <= PLATE_MAX_VISIBLE) {
+        for (int k = 0; k < s->count; k++) {
+            Vector2 p = SnapshotPosition(s, k, alpha);
+            if (p.x < lo.x || p.x > hi.x || p.y < lo.y || p.y > hi.y) continue;
+            DrawText(s->plate[k], (int)(p.x - CAR_WID * 0.5f - 6), (int)(p.y - CAR_LEN * 0.5f - 14), 10, BLACK);
+            stats.plates++;
         }
+    }
 
-        // decay lane saturation timers
-        for(int r=0;r<4;r++) for(int l=0;l<3;l++)
-            if(laneSatTimer[r][l]>0) laneSatTimer[r][l]-=dt;
+    stats.drawCalls = stats.sprites + stats.plates;
+    vehicleDrawStats = stats;
+}
 
-        UpdateVehicles(dt);
+// Latency overlay (toggled with M): per approach lane waits, queue delays,
+// throughput and drops from the latest snapshot
+static bool showMetrics = true;
 
-        BeginDrawing();
-        DrawRoads();
-        DrawLights();
-        DrawVehicles();
-        DrawLaneMarkers();
-        DrawLaneLabels();
-        DrawLaneAlerts();
-        DrawPriorityStatus();
-        if(al2PriorityActive)
-            DrawText("Green: A (AL2 priority hold)",20,20,22,BLACK);
-        else
-            DrawText(TextFormat("Green: %c   Phase: %.1f/%.1f",'A'+currentGreen,phaseTimer,currentGreenDuration),20,20,22,BLACK);
+static void DrawMetricsOverlay(const SimSnapshot *s) {
+    if (IsKeyPressed(KEY_M)) showMetrics = !showMetrics;
+    if (!showMetrics) return;
+
+    const int fontSize = 14, lineH = 17, width = 520;
+    int x = s->screenW - width - 20, y = 50;
+    if (x < 20) x = 20;
+    DrawRectangle(x - 8, y - 6, width + 16, lineH * 12 + 8, Fade(WHITE, 0.8f));
+    DrawText("lane  crossed  veh/min   wait p50/p95/p99/max     queue p50/p95/p99/max  drop", x, y, fontSize, BLACK);
+    y += lineH;
+    for (int r = 0; r < 4; r++) {
+        for (int l = 1; l < 3; l++) {
+            const LaneMetrics *m = &s->laneMetrics[r][l];
+            DrawText(TextFormat("%c L%d  %7ld  %7.1f  %5.1f/%5.1f/%5.1f/%5.1f  %5.1f/%5.1f/%5.1f/%5.1f  %4ld",
+                                'A' + r, l + 1, m->crossings, m->throughput,
+                                m->wait.p50, m->wait.p95, m->wait.p99, m->wait.max,
+                                m->queueDelay.p50, m->queueDelay.p95, m->queueDelay.p99, m->queueDelay.max,
+                                m->dropped),
+                     x, y, fontSize, m->dropped > 0 ? RED : DARKGRAY);
+            y += lineH;
+        }
+    }
+    const LaneMetrics *a = &s->allLanes;
+    DrawText(TextFormat("all   %7ld  %7.1f  %5.1f/%5.1f/%5.1f/%5.1f  %5.1f/%5.1f/%5.1f/%5.1f  %4ld",
+                        a->crossings, a->throughput, a->wait.p50, a->wait.p95, a->wait.p99, a->wait.max,
+                        a->queueDelay.p50, a->queueDelay.p95, a->queueDelay.p99, a->queueDelay.max, a->dropped),
+             x, y, fontSize, BLACK);
+    y += lineH;
+    if (s->ingest.count > 0)
+        DrawText(TextFormat("ingest latency p50 %.0f ms  p99 %.0f ms  max %.0f ms",
+                            s->ingest.p50 * 1000, s->ingest.p99 * 1000, s->ingest.max * 1000), x, y, fontSize, DARKGRAY);
+    y += lineH;
+    DrawText("times in seconds, M hides", x, y, fontSize, DARKGRAY);
+}
+
+#ifdef SIM_PROFILE
+// Frame-time breakdown (toggled with P): average ms per call and calls per
+// second of every zone over the last half second, from the profiler totals
+static bool showProfile = true;
+
+static void DrawProfileOverlay(const SimSnapshot *s) {
+    static int64_t lastNs[PROF_ZONE_COUNT], lastCalls[PROF_ZONE_COUNT];
+    static float avgMs[PROF_ZONE_COUNT], perSecond[PROF_ZONE_COUNT];
+    static double lastSample = 0.0;
+    if (IsKeyPressed(KEY_P)) showProfile = !showProfile;
+
+    double now = GetTime();
+    if (now - lastSample >= 0.5) {
+        for (int z = 0; z < PROF_ZONE_COUNT; z++) {
+            int64_t ns = atomic_load(&profileTotalNs[z]), calls = atomic_load(&profileCalls[z]);
+            int64_t dCalls = calls - lastCalls[z];
+            avgMs[z] = dCalls > 0 ? (float)((ns - lastNs[z]) / 1e6 / dCalls) : 0.0f;
+            perSecond[z] = (float)(dCalls / (now - lastSample));
+            lastNs[z] = ns;
+            lastCalls[z] = calls;
+        }
+        lastSample = now;
+    }
+    if (!showProfile) return;
+
+    const int fontSize = 14, lineH = 16;
+    int y = s->screenH - 100 - lineH * (PROF_ZONE_COUNT + 1);
+    DrawRectangle(12, y - 4, 330, lineH * (PROF_ZONE_COUNT + 1) + 8, Fade(WHITE, 0.8f));
+    DrawText("zone                    ms/call   calls/s", 20, y, fontSize, BLACK);
+    for (int z = 0; z < PROF_ZONE_COUNT; z++) {
+        y += lineH;
+        DrawText(TextFormat("%-22s %8.3f %8.0f", profileZoneNames[z], avgMs[z], perSecond[z]), 20, y, fontSize,
+                 (z == PROF_TICK || z == PROF_PRESENT) ? BLACK : DARKGRAY);
+    }
+}
+#endif
+
+// FPS and how much DrawVehicles submitted this frame (raylib merges the
+// sprite quads into one GPU batch, the plates into another)
+static void DrawRenderStats(const SimSnapshot *s) {
+    const VehicleDrawStats *st = &vehicleDrawStats;
+    const char *text = TextFormat("FPS %d (%.1f ms)  cars %d/%d  plates %d  draw calls %d  zoom %.2f",
+                                  GetFPS(), GetFrameTime() * 1000.0f, st->sprites, s->count,
+                                  st->plates, st->drawCalls, camera.zoom);
+    int x = s->screenW - MeasureText(text, 16) - 20;
+    DrawText(text, x < 20 ? 20 : x, s->screenH - 30, 16, DARKGRAY);
+}
+#endif
+
+// Intersection an arrival on `road` enters at: on a grid, a random junction
+// along that road's edge (road A arrivals come in from the top row, etc.)
+static int ArrivalNode(int road) {
+    if (nodeCount == 1) return 0;
+    switch (road) {
+        case 0: return RngRange(&arrivalRng, 0, gridCols - 1);
+        case 1: return (gridRows - 1) * gridCols + RngRange(&arrivalRng, 0, gridCols - 1);
+        case 2: return RngRange(&arrivalRng, 0, gridRows - 1) * gridCols + gridCols - 1;
+        default: return RngRange(&arrivalRng, 0, gridRows - 1) * gridCols;
+    }
+}
+
+// Arrival trace (--record FILE, --replay FILE)
+// The generator truncates vehicles.data on exit and trims old lines, so
+// the load behind a run is gone once it ends. --record appends every
+// arrival the simulation ingests, stamped with the simulated time of its
+// tick and the junction it entered at, to a compact binary trace; --replay
+// feeds such a trace back through the same spawn path in place of the
+// live sources. With the recorded seed (the default), --dt and policy the
+// replay ends in the same state as the recorded run. --replay-speed sets
+// how fast simulated time runs against the wall clock.
+
+#define ARRIVAL_TRACE_MAGIC "VTRC"
+#define ARRIVAL_TRACE_VERSION 1u
+
+typedef struct {
+    char magic[4];           // ARRIVAL_TRACE_MAGIC
+    uint32_t version;        // ARRIVAL_TRACE_VERSION
+    uint32_t recordSize;     // sizeof(ArrivalTraceRecord)
+    float dt;                // timestep of the recorded run
+    uint64_t seed;           // seed of the recorded run
+} ArrivalTraceHeader;
+
+typedef struct {
+    double time;             // simTime of the tick that ingested it
+    char plate[16];          // empty when the simulator generated the plate
+    uint32_t node;           // junction it entered at
+    uint8_t road;
+    uint8_t lane;
+    uint8_t reserved[2];
+} ArrivalTraceRecord;
+
+static const char *recordPath = NULL;  // --record
+static const char *replayPath = NULL;  // --replay
+static FILE *recordFile = NULL;
+static long recordedArrivals = 0;
+
+static bool OpenArrivalRecord(float dt) {
+    recordFile = fopen(recordPath, "wb");
+    if (!recordFile) { fprintf(stderr, "cannot write %s\n", recordPath); return false; }
+    setvbuf(recordFile, NULL, _IOFBF, 1 << 16);
+    ArrivalTraceHeader h = {{0}, ARRIVAL_TRACE_VERSION, sizeof(ArrivalTraceRecord), dt, simSeed};
+    memcpy(h.magic, ARRIVAL_TRACE_MAGIC, sizeof(h.magic));
+    fwrite(&h, sizeof(h), 1, recordFile);
+    return true;
+}
+
+static void RecordArrival(int node, const char *plate, int road, int lane) {
+    ArrivalTraceRecord rec = {simTime, {0}, (uint32_t)node, (uint8_t)road, (uint8_t)lane, {0}};
+    if (plate) strncpy(rec.plate, plate, sizeof(rec.plate) - 1);
+    if (fwrite(&rec, sizeof(rec), 1, recordFile) == 1) recordedArrivals++;
+}
+
+static void CloseArrivalRecord(void) {
+    if (!recordFile) return;
+    fclose(recordFile);
+    recordFile = NULL;
+}
+
+// Spawn one arrival at junction `node`, flagging the lane as saturated when it is (or becomes) full
+static void IngestArrivalAt(int node, const char *plate, int road, int lane) {
+    if (recordFile) RecordArrival(node, plate, road, lane);
+    Intersection *n = &nodes[node];
+    int before = LaneCount(n, road, lane);
+    if (before >= 10) n->satTimer[road][lane] = 3.0f; // already saturated
+
+    SpawnVehicle((int)(n - nodes), road, lane, plate);
+
+    int after = LaneCount(n, road, lane);
+    if (after >= 10) n->satTimer[road][lane] = 3.0f; // hit or stay saturated after spawn
+}
+
+static void IngestArrival(const char *plate, int road, int lane) {
+    IngestArrivalAt(ArrivalNode(road), plate, road, lane);
+}
+
+// Validate a record from any transport and spawn it
+static void IngestRecord(const VehicleRecord *rec) {
+    if (rec->road > 3 || rec->lane > 2) return;
+    if (rec->lane == 0) return; // lane 0 vehicles now only enter via intersection transitions
+    if (rec->emitNs > 0) HistogramRecord(&metrics.ingest, (WallClockNs() - rec->emitNs) * 1e-9);
+    char plate[sizeof(rec->plate)];
+    memcpy(plate, rec->plate, sizeof(plate));
+    plate[sizeof(plate) - 1] = '\0';
+    IngestArrival(plate, rec->road, rec->lane);
+}
+
+// Where the log readers deliver records: IngestLogRecord when polling on the
+// simulation thread, the watch thread's queue with --watch
+typedef void (*ArrivalSink)(const VehicleRecord *rec);
+
+// Log records tell the simulation thread where they came from: the readers
+// put the epoch of their segment in the record's reserved bytes (records
+// never leave the process after that), and give lines of a header-less file,
+// which have no sequence number, the byte offset just past the line as seq.
+// IngestLogRecord keeps the position of the last record spawned, which is
+// what a checkpoint saves; the --watch thread has usually read beyond it.
+static struct {
+    uint32_t epoch;              // generator run, 0 for a header-less file
+    unsigned long long next;     // next seq to spawn, or byte offset in a header-less file
+} ingestCursor;
+
+static void SetRecordEpoch(VehicleRecord *rec, uint32_t epoch) {
+    memcpy(rec->reserved, &epoch, sizeof(epoch));
+}
+
+static void IngestLogRecord(const VehicleRecord *rec) {
+    memcpy(&ingestCursor.epoch, rec->reserved, sizeof(ingestCursor.epoch));
+    ingestCursor.next = ingestCursor.epoch ? rec->seq + 1 : rec->seq;
+    IngestRecord(rec);
+}
+
+// Parse "PLATE:ROAD:LANE". Returns false for malformed lines.
+static bool ParseTextRecord(const char *text, VehicleRecord *rec) {
+    char roadChar;
+    int lane;
+    memset(rec, 0, sizeof(*rec));
+    if (sscanf(text, "%15[^:]:%c:%d", rec->plate, &roadChar, &lane) != 3) return false;
+    int road = RoadIndexFromChar(roadChar);
+    if (road < 0 || lane < 0 || lane > 2) return false;
+    rec->road = (uint8_t)road;
+    rec->lane = (uint8_t)lane;
+    return true;
+}
+
+// Header-less vehicles.data (hand-written PLATE:ROAD:LANE lines): follow it by byte offset
+static int ReadLegacyFile(FILE *f, int budget, ArrivalSink sink) {
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    if (size < vehiclesFilePos) vehiclesFilePos = 0; // file truncated/rotated
+    fseek(f, vehiclesFilePos, SEEK_SET);
+
+    char line[256];
+    int delivered = 0;
+    while (delivered < budget && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        VehicleRecord rec;
+        if (!ParseTextRecord(line, &rec)) continue;
+        rec.seq = (unsigned long long)ftell(f);
+        sink(&rec);
+        delivered++;
+    }
+
+    vehiclesFilePos = ftell(f);
+    return delivered;
+}
+
+// Position in the generator's segmented log (see vehicle_ipc.h), in either format.
+// segBase names the segment being read (its first seq) and pos the byte
+// offset in it; pos < 0 means "just after the header". nextSeq is the next
+// record expected, so rotations never replay or skip records; records
+// rotated away before we read them are counted in lostRecords.
+typedef struct {
+    uint32_t epoch;          // generator run being followed, 0 before the first header
+    unsigned long long segBase;
+    long pos;
+    unsigned long long nextSeq;
+    long lostRecords;
+} ArrivalLogReader;
+
+static ArrivalLogReader arrivalLog = {0, 0, -1, 0, 0};
+
+// Parse either segment header format; leaves f positioned at the first record
+static bool ReadSegmentHeader(FILE *f, uint32_t *epoch, unsigned long long *base, bool *binary) {
+    VehicleSegmentHeader h;
+    if (fread(h.magic, 1, sizeof(h.magic), f) != sizeof(h.magic)) return false;
+
+    if (memcmp(h.magic, VEHICLE_LOG_MAGIC, sizeof(h.magic)) == 0) {
+        if (fread((char *)&h + sizeof(h.magic), sizeof(h) - sizeof(h.magic), 1, f) != 1) return false;
+        if (h.version != VEHICLE_LOG_VERSION || h.recordSize != sizeof(VehicleRecord)) return false;
+        *epoch = h.epoch;
+        *base = h.baseSeq;
+        *binary = true;
+        return true;
+    }
+
+    char line[64];
+    memcpy(line, h.magic, sizeof(h.magic));
+    if (!fgets(line + sizeof(h.magic), sizeof(line) - sizeof(h.magic), f)) return false;
+    unsigned int e;
+    if (sscanf(line, "#SEG %u %llu", &e, base) != 2) return false;
+    *epoch = e;
+    *binary = false;
+    return true;
+}
+
+// Sequence bookkeeping shared by both formats: false for records already ingested
+static bool AcceptSequence(unsigned long long seq) {
+    if (seq < arrivalLog.nextSeq) return false;
+    arrivalLog.lostRecords += (long)(seq - arrivalLog.nextSeq);
+    arrivalLog.nextSeq = seq + 1;
+    return true;
+}
+
+// Deliver complete "<seq>:PLATE:ROAD:LANE" lines from arrivalLog.pos on, up to
+// budget records. Sets *atEnd when the segment has no further complete line.
+static int DrainTextSegment(FILE *f, int budget, ArrivalSink sink, bool *atEnd) {
+    char line[256];
+    int delivered = 0;
+    *atEnd = false;
+    while (delivered < budget) {
+        if (!fgets(line, sizeof(line), f) || !strchr(line, '\n')) { // EOF or line still being written
+            *atEnd = true;
+            break;
+        }
+        arrivalLog.pos = ftell(f);
+        line[strcspn(line, "\r\n")] = 0;
+
+        unsigned long long seq;
+        int consumed = 0;
+        VehicleRecord rec;
+        if (sscanf(line, "%llu:%n", &seq, &consumed) != 1 || consumed == 0) continue;
+        if (!ParseTextRecord(line + consumed, &rec) || !AcceptSequence(seq)) continue;
+        rec.seq = seq;
+        SetRecordEpoch(&rec, arrivalLog.epoch);
+        sink(&rec);
+        delivered++;
+    }
+    return delivered;
+}
+
+// Binary segments: bulk reads of fixed-width records (one fread per poll at
+// the usual per-tick budget). A record still being written is left for later.
+#define ARRIVAL_READ_CHUNK 64
+
+static int DrainBinarySegment(FILE *f, int budget, ArrivalSink sink, bool *atEnd) {
+    VehicleRecord recs[ARRIVAL_READ_CHUNK];
+    int delivered = 0;
+    *atEnd = false;
+    while (delivered < budget) {
+        int want = budget - delivered;
+        if (want > ARRIVAL_READ_CHUNK) want = ARRIVAL_READ_CHUNK;
+        int n = (int)fread(recs, sizeof(VehicleRecord), (size_t)want, f);
+        arrivalLog.pos += (long)n * (long)sizeof(VehicleRecord);
+        for (int k = 0; k < n; k++) {
+            if (!AcceptSequence(recs[k].seq)) continue;
+            SetRecordEpoch(&recs[k], arrivalLog.epoch);
+            sink(&recs[k]);
+            delivered++;
+        }
+        if (n < want) {
+            *atEnd = true;
+            break;
+        }
+    }
+    return delivered;
+}
+
+static int DrainSegment(FILE *f, bool binary, int budget, ArrivalSink sink, bool *atEnd) {
+    if (arrivalLog.pos < 0) arrivalLog.pos = ftell(f); // first read: right after the header
+    fseek(f, arrivalLog.pos, SEEK_SET);                // also clears a previous EOF
+    return binary ? DrainBinarySegment(f, budget, sink, atEnd) : DrainTextSegment(f, budget, sink, atEnd);
+}
+
+// Live segment kept open between reads by the --watch thread
+static FILE *liveSegment = NULL;
+static bool liveSegmentBinary = false;
+
+// Read new arrivals from vehicles.data and hand up to budget of them to sink.
+// The common case touches only the live segment; when it no longer is the
+// segment being followed (rotation, new generator run) the renamed segments
+// are drained oldest first. With keepOpen the live segment stays open and is
+// reused until the caller asks for a rescan; otherwise each call reopens it.
+static int ReadArrivalLog(int budget, ArrivalSink sink, bool rescan, bool keepOpen) {
+    bool atEnd;
+    if (liveSegment && !rescan) {
+        int n = DrainSegment(liveSegment, liveSegmentBinary, budget, sink, &atEnd);
+        fseek(liveSegment, 0, SEEK_END);
+        if (n > 0 || ftell(liveSegment) >= arrivalLog.pos) return n;
+        // file shrank under us: truncated by a new generator run, rescan below
+    }
+    if (liveSegment) {
+        fclose(liveSegment);
+        liveSegment = NULL;
+    }
+
+    FILE *f = fopen(VEHICLE_LOG_FILE, "rb");
+    if (!f) return 0;
+
+    uint32_t epoch;
+    unsigned long long base;
+    bool binary;
+    if (!ReadSegmentHeader(f, &epoch, &base, &binary)) {
+        int n = ReadLegacyFile(f, budget, sink);
+        fclose(f);
+        return n;
+    }
+
+    if (epoch == arrivalLog.epoch && base == arrivalLog.segBase) {
+        int n = DrainSegment(f, binary, budget, sink, &atEnd);
+        if (keepOpen) {
+            liveSegment = f;
+            liveSegmentBinary = binary;
+        } else {
+            fclose(f);
+        }
+        return n;
+    }
+    fclose(f);
+
+    // New generator run: start from its oldest retained segment
+    bool fresh = (epoch != arrivalLog.epoch);
+    if (fresh) {
+        arrivalLog.epoch = epoch;
+        arrivalLog.segBase = 0;
+        arrivalLog.pos = -1;
+        arrivalLog.nextSeq = 0;
+    }
+
+    int delivered = 0;
+    for (int k = VEHICLE_LOG_KEEP; k >= 0 && delivered < budget; k--) {
+        char name[64];
+        VehicleLogSegmentName(name, sizeof(name), k);
+        f = fopen(name, "rb");
+        if (!f) continue;
+        if (!ReadSegmentHeader(f, &epoch, &base, &binary) || epoch != arrivalLog.epoch || base < arrivalLog.segBase) {
+            fclose(f); // other run, or a segment we have already finished
+            continue;
+        }
+        if (base > arrivalLog.segBase) {
+            // our segment was rotated away (or this is a fresh start): jump ahead
+            arrivalLog.segBase = base;
+            arrivalLog.pos = -1;
+            if (fresh) arrivalLog.nextSeq = base;
+        }
+        fresh = false;
+
+        delivered += DrainSegment(f, binary, budget - delivered, sink, &atEnd);
+        if (k == 0 && keepOpen) {
+            liveSegment = f;
+            liveSegmentBinary = binary;
+        } else {
+            fclose(f);
+        }
+        if (atEnd && k > 0) {
+            // rotated segments are complete: move past this one. Not to nextSeq,
+            // which after a restore can lie inside a later segment
+            arrivalLog.segBase = base + 1;
+            arrivalLog.pos = -1;
+        }
+    }
+    return delivered;
+}
+
+// Poll vehicles.data from the simulation thread (reopened every tick)
+static void PollVehicleFile(void) {
+    ReadArrivalLog(MAX_SPAWNS_PER_TICK, IngestLogRecord, true, false);
+}
+
+// Shared-memory transport (--shm): drain up to MAX_SPAWNS_PER_TICK records
+// from the generator's ring. Returns false while no ring is attached so the
+// caller falls back to the file; re-attaches after the generator restarts.
+static bool useShmTransport = false;
+static VehicleRing *arrivalRing = NULL;
+static int ringAttachCooldown = 0;
+
+static bool PollVehicleRing(void) {
+    if (arrivalRing && VehicleRingClosed(arrivalRing)) {
+        VehicleRingDetach(arrivalRing);
+        arrivalRing = NULL;
+    }
+    if (!arrivalRing) {
+        if (ringAttachCooldown-- > 0) return false;
+        ringAttachCooldown = 60; // retry about once a second at 60 Hz
+        arrivalRing = VehicleRingAttach();
+        if (!arrivalRing) return false;
+    }
+
+    VehicleRecord recs[MAX_SPAWNS_PER_TICK];
+    int n = VehicleRingPop(arrivalRing, recs, MAX_SPAWNS_PER_TICK);
+    for (int k = 0; k < n; k++) IngestRecord(&recs[k]);
+    return true;
+}
+
+// Event-driven file ingestion (--watch, Linux): a thread sleeps on inotify
+// for the directory holding vehicles.data, reads new records only when the
+// generator writes or rotates, and queues them on a process-local SPSC ring.
+// The simulation loop then only pops from that queue. Elsewhere --watch
+// falls back to per-tick polling.
+static bool arrivalWatchRunning = false;
+
+#ifdef __linux__
+static VehicleRing *arrivalQueue = NULL;
+static pthread_t arrivalWatchThread;
+static int arrivalWatchStop[2] = {-1, -1}; // pipe written to wake the thread for shutdown
+
+static void QueueArrival(const VehicleRecord *rec) {
+    VehicleRingPush(arrivalQueue, rec, 1); // ReadArrivalLog budget = queue room, so this fits
+}
+
+static bool IsLogFileEvent(const struct inotify_event *ev) {
+    size_t n = strlen(VEHICLE_LOG_FILE);
+    return ev->len > 0 && strncmp(ev->name, VEHICLE_LOG_FILE, n) == 0 &&
+           (ev->name[n] == '\0' || ev->name[n] == '.');
+}
+
+static void *ArrivalWatchMain(void *arg) {
+    (void)arg;
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd >= 0 && inotify_add_watch(ifd, ".", IN_MODIFY | IN_CREATE | IN_MOVED_FROM |
+                                                IN_MOVED_TO | IN_DELETE) < 0) {
+        close(ifd);
+        ifd = -1; // no inotify: fall back to a slow timed poll below
+    }
+
+    bool rescan = true;
+    for (;;) {
+        int room;
+        while ((room = VehicleRingRoom(arrivalQueue)) > 0) {
+            int n = ReadArrivalLog(room, QueueArrival, rescan, true);
+            rescan = false;
+            if (n < room) break; // caught up with the generator
+        }
+
+        // queue full: give the simulation a moment; otherwise sleep until the log changes
+        int timeoutMs = (room == 0) ? 1 : (ifd >= 0 ? 1000 : 16);
+        struct pollfd fds[2] = {{ifd, POLLIN, 0}, {arrivalWatchStop[0], POLLIN, 0}};
+        if (poll(fds, 2, timeoutMs) > 0 && fds[1].revents) break;
+        if (ifd < 0 || !(fds[0].revents & POLLIN)) continue;
+
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + len;) {
+                const struct inotify_event *ev = (const struct inotify_event *)p;
+                if (IsLogFileEvent(ev) && (ev->mask & (IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE)))
+                    rescan = true; // rotation or a new generator run
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+
+    if (ifd >= 0) close(ifd);
+    if (liveSegment) {
+        fclose(liveSegment);
+        liveSegment = NULL;
+    }
+    return NULL;
+}
+
+static void StartArrivalWatch(void) {
+    arrivalQueue = aligned_alloc(64, (VehicleRingBytes() + 63) & ~(size_t)63);
+    if (!arrivalQueue) return;
+    VehicleRingInit(arrivalQueue);
+    if (pipe(arrivalWatchStop) != 0) return;
+    arrivalWatchRunning = (pthread_create(&arrivalWatchThread, NULL, ArrivalWatchMain, NULL) == 0);
+}
+
+static void StopArrivalWatch(void) {
+    if (!arrivalWatchRunning) return;
+    if (write(arrivalWatchStop[1], "x", 1) != 1) perror("arrival watch stop");
+    pthread_join(arrivalWatchThread, NULL);
+    arrivalWatchRunning = false;
+}
+
+static void DrainArrivalQueue(void) {
+    VehicleRecord recs[MAX_SPAWNS_PER_TICK];
+    int n = VehicleRingPop(arrivalQueue, recs, MAX_SPAWNS_PER_TICK);
+    for (int k = 0; k < n; k++) IngestLogRecord(&recs[k]);
+}
+#else
+static void StartArrivalWatch(void) {
+    fprintf(stderr, "--watch needs inotify (Linux); polling vehicles.data instead\n");
+}
+static void StopArrivalWatch(void) {}
+static void DrainArrivalQueue(void) {}
+#endif
+
+// Synthetic arrivals (--arrivals RATE): a Poisson stream of RATE vehicles
+// per simulated second drawn from the run's own arrival stream, onto a
+// uniformly random road and approach lane, instead of reading the
+// generator. Independent runs (scenario_runner) then need no shared files.
+static double syntheticRate = 0.0;
+static double nextSyntheticArrival = -1.0;
+
+static double ExponentialGap(double rate) {
+    return -log(1.0 - RngUniform(&arrivalRng)) / rate;
+}
+
+static void SpawnSyntheticArrivals(void) {
+    if (nextSyntheticArrival < 0.0) nextSyntheticArrival = ExponentialGap(syntheticRate);
+    while (nextSyntheticArrival <= simTime) {
+        int road = RngRange(&arrivalRng, 0, 3);
+        int lane = RngRange(&arrivalRng, 1, 2);
+        IngestArrival(NULL, road, lane);
+        nextSyntheticArrival += ExponentialGap(syntheticRate);
+    }
+}
+
+// Replay side of the arrival trace: records are read a chunk at a time and
+// spawned on the first tick whose simTime has reached their timestamp
+static FILE *replayFile = NULL;
+static ArrivalTraceRecord replayChunk[ARRIVAL_READ_CHUNK];
+static int replayNext = 0, replayCount = 0;
+static long replayConsumed = 0;  // records taken from the trace, for checkpoints
+static long replayedArrivals = 0;
+
+// Check the header; the recorded seed is returned so the run can reuse it
+static bool OpenArrivalReplay(float dt, uint64_t *seed) {
+    replayFile = fopen(replayPath, "rb");
+    if (!replayFile) { fprintf(stderr, "cannot read %s\n", replayPath); return false; }
+    ArrivalTraceHeader h;
+    if (fread(&h, sizeof(h), 1, replayFile) != 1 || memcmp(h.magic, ARRIVAL_TRACE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != ARRIVAL_TRACE_VERSION || h.recordSize != sizeof(ArrivalTraceRecord)) {
+        fprintf(stderr, "%s is not an arrival trace\n", replayPath);
+        fclose(replayFile);
+        replayFile = NULL;
+        return false;
+    }
+    if (h.dt != dt)
+        fprintf(stderr, "%s was recorded with dt=%.4f, replaying at dt=%.4f: arrivals shift to the nearest tick\n",
+                replayPath, h.dt, dt);
+    *seed = h.seed;
+    return true;
+}
+
+static const ArrivalTraceRecord *PeekReplay(void) {
+    if (replayNext == replayCount) {
+        replayCount = (int)fread(replayChunk, sizeof(replayChunk[0]), ARRIVAL_READ_CHUNK, replayFile);
+        replayNext = 0;
+        if (replayCount == 0) return NULL; // end of trace (a torn last record is dropped)
+    }
+    return &replayChunk[replayNext];
+}
+
+static void ReplayArrivals(void) {
+    const ArrivalTraceRecord *rec;
+    while ((rec = PeekReplay()) && rec->time <= simTime) {
+        replayNext++;
+        replayConsumed++;
+        if (rec->road > 3 || rec->lane < 1 || rec->lane > 2) continue;
+        char plate[sizeof(rec->plate)];
+        memcpy(plate, rec->plate, sizeof(plate));
+        plate[sizeof(plate) - 1] = '\0';
+        int node = (rec->node < (uint32_t)nodeCount) ? (int)rec->node : ArrivalNode(rec->road);
+        IngestArrivalAt(node, plate[0] ? plate : NULL, rec->road, rec->lane);
+        replayedArrivals++;
+    }
+}
+
+static void CloseArrivalReplay(void) {
+    if (!replayFile) return;
+    fclose(replayFile);
+    replayFile = NULL;
+}
+
+// Pull this tick's arrivals: a replayed trace, synthetic, shared-memory ring if attached, else the file
+static void IngestArrivals(void) {
+    if (replayFile) { ReplayArrivals(); return; }
+    if (syntheticRate > 0.0) { SpawnSyntheticArrivals(); return; }
+    if (useShmTransport && PollVehicleRing()) return;
+    if (arrivalWatchRunning) DrainArrivalQueue();
+    else PollVehicleFile();
+}
+
+// Signal policies
+// A policy decides, each time a phase ends, which road gets the green next
+// and for how long; an optional priority hook runs every tick before that
+// and may override the phase (the default policy's AL2 hold). Pick one with
+// --policy NAME; all of them serve one road at a time.
+//   default       round robin, green for the average L2 queue, AL2 hold
+//   max-pressure  road whose L2 queue most exceeds what its exit lanes hold
+//   longest-wait  road whose L2 leader has been stopped the longest
+//   weighted      road with the largest weighted queue (--lane-weight RL=W)
+
+#define MAX_GREEN 30.0f            // cap for the adaptive policies' green time
+#define PRESSURE_SLOT 2.0f         // max-pressure re-decides this often
+
+typedef struct {
+    const char *name;
+    void (*updatePriority)(Intersection *n);            // may be NULL
+    int (*nextGreen)(const Intersection *n);
+    float (*greenDuration)(const Intersection *n, int road);
+} SignalPolicy;
+
+static float laneWeights[4][3] = {{1, 1, 1}, {1, 1, 1}, {1, 1, 1}, {1, 1, 1}};
+
+static float ClampGreen(float seconds) {
+    if (seconds < timePerVehicle) return timePerVehicle;
+    return (seconds > MAX_GREEN) ? MAX_GREEN : seconds;
+}
+
+// Road with the highest score, searching from the one after the current
+// green so ties rotate instead of starving a road
+static int BestRoad(const Intersection *n, float (*score)(const Intersection *n, int road)) {
+    int best = (n->currentGreen + 1) % 4;
+    float bestScore = score(n, best);
+    for (int k = 2; k <= 4; k++) {
+        int r = (n->currentGreen + k) % 4;
+        float sc = score(n, r);
+        if (sc > bestScore) { best = r; bestScore = sc; }
+    }
+    return best;
+}
+
+static int RoundRobinGreen(const Intersection *n) {
+    return (n->currentGreen + 1) % 4;
+}
+
+static float AverageQueueGreen(const Intersection *n, int road) {
+    (void)road;
+    return calculateGreenDuration(n);
+}
+
+// L2 queue on `road` less half of what already sits on the exit lanes its
+// straight and right turns feed (a backed-up exit lane blocks the box)
+static float LanePressure(const Intersection *n, int road) {
+    return LaneCount(n, road, 1) - 0.5f * (LaneCount(n, RoadOpposite(road), 0) + LaneCount(n, RoadRight(road), 0));
+}
+
+static int MaxPressureGreen(const Intersection *n) {
+    return BestRoad(n, LanePressure);
+}
+
+static float FixedSlotGreen(const Intersection *n, int road) {
+    (void)n; (void)road;
+    return PRESSURE_SLOT;
+}
+
+// How long the L2 leader on `road` has been stopped (0 if it is moving or the lane is empty)
+static float LeaderWait(const Intersection *n, int road) {
+    const LaneQueue *q = &n->queues[road][1];
+    if (q->count == 0) return 0.0f;
+    double halt = vehicles.haltTime[q->indices[q->front]];
+    return (halt < 0.0) ? 0.0f : (float)(simTime - halt);
+}
+
+static int LongestWaitGreen(const Intersection *n) {
+    return BestRoad(n, LeaderWait);
+}
+
+static float QueueGreen(const Intersection *n, int road) {
+    return ClampGreen(LaneCount(n, road, 1) * timePerVehicle);
+}
+
+static float WeightedQueue(const Intersection *n, int road) {
+    float sum = 0.0f;
+    for (int l = 1; l < 3; l++) sum += laneWeights[road][l] * LaneCount(n, road, l);
+    return sum;
+}
+
+static int WeightedGreen(const Intersection *n) {
+    return BestRoad(n, WeightedQueue);
+}
+
+static float WeightedQueueGreen(const Intersection *n, int road) {
+    return ClampGreen(WeightedQueue(n, road) * timePerVehicle);
+}
+
+static const SignalPolicy signalPolicies[] = {
+    {"default", UpdateAl2PriorityState, RoundRobinGreen, AverageQueueGreen},
+    {"max-pressure", NULL, MaxPressureGreen, FixedSlotGreen},
+    {"longest-wait", NULL, LongestWaitGreen, QueueGreen},
+    {"weighted", NULL, WeightedGreen, WeightedQueueGreen},
+};
+#define SIGNAL_POLICY_COUNT ((int)(sizeof(signalPolicies) / sizeof(signalPolicies[0])))
+
+static const SignalPolicy *signalPolicy = &signalPolicies[0]; // --policy
+
+static bool SelectSignalPolicy(const char *name) {
+    for (int k = 0; k < SIGNAL_POLICY_COUNT; k++) {
+        if (strcmp(signalPolicies[k].name, name) == 0) { signalPolicy = &signalPolicies[k]; return true; }
+    }
+    return false;
+}
+
+// Parse "RL=W" (road letter, lane 1-3, weight), e.g. "A2=3"
+static bool ParseLaneWeight(const char *text) {
+    char roadChar;
+    int lane;
+    float weight;
+    if (sscanf(text, "%c%d=%f", &roadChar, &lane, &weight) != 3) return false;
+    int road = RoadIndexFromChar(roadChar);
+    if (road < 0 || lane < 2 || lane > 3 || weight < 0.0f) return false; // WeightedQueue sums L2 and L3 only
+    laneWeights[road][lane - 1] = weight;
+    return true;
+}
+
+// Metrics export
+// With --metrics-csv and/or --metrics-json the simulation writes the lane
+// metrics every --metrics-every simulated seconds: the CSV gains one row per
+// approach lane plus an ALL row per export, the JSON file is replaced with
+// the latest figures (written to a temporary file, then renamed).
+
+static const char *metricsCsvPath = NULL;
+static const char *metricsJsonPath = NULL;
+static double metricsInterval = 10.0;
+static double lastMetricsExport = 0.0;
+static FILE *metricsCsv = NULL;
+
+static void WriteCsvRow(FILE *f, const char *road, int lane, const LaneMetrics *m) {
+    const LatencySummary *w = &m->wait, *q = &m->queueDelay;
+    fprintf(f, "%.1f,%s,%d,%ld,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%ld\n",
+            simTime, road, lane, m->crossings, m->throughput, w->p50, w->p95, w->p99, w->max,
+            q->p50, q->p95, q->p99, q->max, m->dropped);
+}
+
+static void ExportMetricsCsv(void) {
+    if (!metricsCsv) {
+        metricsCsv = fopen(metricsCsvPath, "w");
+        if (!metricsCsv) { fprintf(stderr, "cannot write %s\n", metricsCsvPath); metricsCsvPath = NULL; return; }
+        fprintf(metricsCsv, "time_s,road,lane,crossings,vehicles_per_min,wait_p50_s,wait_p95_s,wait_p99_s,wait_max_s,"
+                            "queue_p50_s,queue_p95_s,queue_p99_s,queue_max_s,dropped\n");
+    }
+    for (int r = 0; r < 4; r++) {
+        for (int l = 1; l < 3; l++) {
+            LaneMetrics m = SummarizeLane(r, l);
+            WriteCsvRow(metricsCsv, (const char[]){(char)('A' + r), 0}, l + 1, &m);
+        }
+    }
+    LaneMetrics all = SummarizeLane(-1, 0);
+    WriteCsvRow(metricsCsv, "ALL", 0, &all);
+    fflush(metricsCsv);
+}
+
+static void WriteJsonSummary(FILE *f, const char *name, const LatencySummary *s) {
+    fprintf(f, "\"%s\": {\"count\": %ld, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}",
+            name, s->count, s->p50, s->p95, s->p99, s->max, s->mean);
+}
+
+static void WriteJsonLane(FILE *f, const LaneMetrics *m) {
+    fprintf(f, "\"crossings\": %ld, \"vehicles_per_min\": %.1f, \"dropped\": %ld, ",
+            m->crossings, m->throughput, m->dropped);
+    WriteJsonSummary(f, "wait_s", &m->wait);
+    fputs(", ", f);
+    WriteJsonSummary(f, "queue_delay_s", &m->queueDelay);
+}
+
+static void ExportMetricsJson(void) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metricsJsonPath);
+    FILE *f = fopen(tmp, "w");
+    if (!f) { fprintf(stderr, "cannot write %s\n", tmp); metricsJsonPath = NULL; return; }
+
+    LatencySummary ingest = SummarizeHistogram(&metrics.ingest);
+    LaneMetrics all = SummarizeLane(-1, 0);
+    fprintf(f, "{\n  \"policy\": \"%s\", \"time_s\": %.1f, \"spawned\": %ld, \"exited\": %ld, \"dropped\": %ld, "
+               "\"lost_records\": %ld, \"queue_overflows\": %ld,\n  ",
+            signalPolicy->name, simTime, totalSpawned, totalExited, droppedSpawns, arrivalLog.lostRecords,
+            queueOverflows);
+    WriteJsonSummary(f, "ingest_latency_s", &ingest);
+    fputs(",\n  \"all\": {", f);
+    WriteJsonLane(f, &all);
+    fputs("},\n  \"lanes\": [", f);
+    for (int r = 0; r < 4; r++) {
+        for (int l = 1; l < 3; l++) {
+            LaneMetrics m = SummarizeLane(r, l);
+            fprintf(f, "%s\n    {\"road\": \"%c\", \"lane\": %d, ", (r == 0 && l == 1) ? "" : ",", 'A' + r, l + 1);
+            WriteJsonLane(f, &m);
+            fputc('}', f);
+        }
+    }
+    fputs("\n  ]\n}\n", f);
+    fclose(f);
+#ifdef _WIN32
+    remove(metricsJsonPath); // rename does not replace on Windows
+#endif
+    if (rename(tmp, metricsJsonPath) != 0) fprintf(stderr, "cannot replace %s\n", metricsJsonPath);
+}
+
+// Write whatever exports are configured; force skips the interval check
+static void ExportMetrics(bool force) {
+    if (!metricsCsvPath && !metricsJsonPath) return;
+    if (!force && simTime - lastMetricsExport < metricsInterval) return;
+    lastMetricsExport = simTime;
+    if (metricsCsvPath) ExportMetricsCsv();
+    if (metricsJsonPath) ExportMetricsJson();
+}
+
+static void CloseMetricsExport(void) {
+    if (simTime > lastMetricsExport) ExportMetrics(true);
+    if (metricsCsv) fclose(metricsCsv);
+    metricsCsv = NULL;
+}
+
+// Light phase and alert timers for one intersection (after its priority check)
+static void UpdateSignal(Intersection *n, float dt) {
+    // traffic light logic
+    if(n->al2PriorityActive){ n->currentGreen=0; n->phaseTimer=0.0f; }
+    else{
+        n->phaseTimer+=dt;
+        if(n->phaseTimer>=n->greenDuration){
+            n->phaseTimer=0.0f;
+            n->currentGreen=signalPolicy->nextGreen(n);
+            n->greenDuration=signalPolicy->greenDuration(n,n->currentGreen);
+        }
+    }
+
+    // decay lane saturation timers
+    for(int r=0;r<4;r++) for(int l=0;l<3;l++)
+        if(n->satTimer[r][l]>0) n->satTimer[r][l]-=dt;
+}
+
+// Checkpoints (--checkpoint FILE, --restore FILE)
+// Every --checkpoint-every simulated seconds (default 60) the simulation
+// copies its whole state (vehicle pool, lane queues, signals, metrics,
+// random streams and arrival position) into one flat buffer between two
+// ticks; a writer thread then saves it to FILE.tmp and renames it over
+// FILE, so a tick only pays for the copy and a crash mid-write leaves the
+// previous checkpoint. A checkpoint due while the last one is still being
+// written is skipped. The run also checkpoints at exit. --restore maps a
+// checkpoint and resumes from it; arrivals continue from the saved log
+// position, trace record or synthetic stream, so none is spawned twice or
+// missed (with --shm the ring keeps its own read position).
+
+#define CHECKPOINT_MAGIC "VCKP"
+#define CHECKPOINT_VERSION 2u
+
+typedef struct {
+    char magic[4];               // CHECKPOINT_MAGIC
+    uint32_t version;            // CHECKPOINT_VERSION
+    uint64_t payloadBytes;       // bytes after the header
+    uint64_t checksum;           // FNV-1a of the payload
+    uint32_t histBuckets;        // HIST_BUCKETS, so the metrics layout matches
+    uint32_t ingestEpoch;        // ingestCursor
+    uint64_t ingestNext;
+    int64_t ingestLost;          // arrivalLog.lostRecords
+    int64_t replayConsumed;
+    double simTime;
+    double nextSyntheticArrival;
+    double lastMetricsExport;
+    uint64_t seed;
+    Rng rngs[3];                 // plates, arrivals, routing
+    int64_t totalSpawned, totalExited, droppedSpawns;
+    int32_t gridRows, gridCols;
+    int32_t vehicleHighWater, freeSlotCount;
+    int32_t screenW, screenH, centerX, centerY;
+    char policy[16];
+} CheckpointHeader;
+
+// Signal and lane state of one intersection; the queue contents follow all
+// of these, front to rear, queueCount[r][l] indices per lane
+typedef struct {
+    int32_t occupancy[4][3];
+    int32_t queueCount[4][3];
+    float satTimer[4][3];
+    int32_t currentGreen;
+    float phaseTimer;
+    float greenDuration;
+    int32_t al2PriorityActive;
+} CheckpointNode;
+
+static const char *checkpointPath = NULL;    // --checkpoint
+static double checkpointInterval = 60.0;     // --checkpoint-every
+static double lastCheckpoint = 0.0;
+static char *checkpointBuf = NULL;
+static size_t checkpointBufCap = 0;
+static long checkpointsWritten = 0, checkpointsSkipped = 0;
+
+static uint64_t Fnv1a(const void *data, size_t n) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (size_t b = 0; b < n; b++) h = (h ^ ((const unsigned char *)data)[b]) * 0x100000001B3ull;
+    return h;
+}
+
+static void CheckpointPut(char **at, const void *src, size_t n) {
+    memcpy(*at, src, n);
+    *at += n;
+}
+
+// Copy the state into checkpointBuf; returns its size, 0 if out of memory
+static size_t CaptureCheckpoint(void) {
+    int hw = vehicleHighWater, words = (hw + 63) / 64;
+    long queued = 0;
+    for (int n = 0; n < nodeCount; n++)
+        for (int r = 0; r < 4; r++)
+            for (int l = 0; l < 3; l++) queued += nodes[n].queues[r][l].count;
+    size_t size = sizeof(CheckpointHeader) + (size_t)hw * (4 * sizeof(float) + 2 + sizeof(unsigned short) +
+                  sizeof(vehicles.plate[0]) + 2 * sizeof(double)) + (size_t)words * sizeof(uint64_t) +
+                  (size_t)freeSlotCount * sizeof(int) + (size_t)nodeCount * sizeof(CheckpointNode) +
+                  (size_t)queued * sizeof(int) + sizeof(SimMetrics);
+    if (size > checkpointBufCap) {
+        char *p = realloc(checkpointBuf, size);
+        if (!p) return 0;
+        checkpointBuf = p;
+        checkpointBufCap = size;
+    }
+
+    CheckpointHeader h = {{0}, CHECKPOINT_VERSION, size - sizeof(h), 0, HIST_BUCKETS,
+                          ingestCursor.epoch, ingestCursor.next, arrivalLog.lostRecords, replayConsumed, simTime,
+                          nextSyntheticArrival, lastMetricsExport, simSeed, {plateRng, arrivalRng, routingRng},
+                          totalSpawned, totalExited, droppedSpawns, gridRows, gridCols, hw, freeSlotCount,
+                          screenW, screenH, centerX, centerY, {0}};
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    strncpy(h.policy, signalPolicy->name, sizeof(h.policy) - 1);
+
+    char *at = checkpointBuf + sizeof(h);
+    CheckpointPut(&at, vehicles.x, (size_t)hw * sizeof(float));
+    CheckpointPut(&at, vehicles.y, (size_t)hw * sizeof(float));
+    CheckpointPut(&at, vehicles.vx, (size_t)hw * sizeof(float));
+    CheckpointPut(&at, vehicles.vy, (size_t)hw * sizeof(float));
+    CheckpointPut(&at, vehicles.road, (size_t)hw);
+    CheckpointPut(&at, vehicles.lane, (size_t)hw);
+    CheckpointPut(&at, vehicles.node, (size_t)hw * sizeof(unsigned short));
+    CheckpointPut(&at, vehicles.plate, (size_t)hw * sizeof(vehicles.plate[0]));
+    CheckpointPut(&at, vehicles.entryTime, (size_t)hw * sizeof(double));
+    CheckpointPut(&at, vehicles.haltTime, (size_t)hw * sizeof(double));
+    CheckpointPut(&at, vehicles.active, (size_t)words * sizeof(uint64_t));
+    CheckpointPut(&at, freeSlots, (size_t)freeSlotCount * sizeof(int));
+    for (int n = 0; n < nodeCount; n++) {
+        const Intersection *node = &nodes[n];
+        CheckpointNode c;
+        memcpy(c.satTimer, node->satTimer, sizeof(c.satTimer));
+        for (int r = 0; r < 4; r++)
+            for (int l = 0; l < 3; l++) {
+                c.occupancy[r][l] = node->occupancy[r][l];
+                c.queueCount[r][l] = node->queues[r][l].count;
+            }
+        c.currentGreen = node->currentGreen;
+        c.phaseTimer = node->phaseTimer;
+        c.greenDuration = node->greenDuration;
+        c.al2PriorityActive = node->al2PriorityActive;
+        CheckpointPut(&at, &c, sizeof(c));
+    }
+    for (int n = 0; n < nodeCount; n++)
+        for (int r = 0; r < 4; r++)
+            for (int l = 0; l < 3; l++) {
+                const LaneQueue *q = &nodes[n].queues[r][l];
+                for (int k = 0; k < q->count; k++)
+                    CheckpointPut(&at, &q->indices[(q->front + k) % q->capacity], sizeof(int));
+            }
+    CheckpointPut(&at, &metrics, sizeof(metrics));
+
+    h.checksum = Fnv1a(checkpointBuf + sizeof(h), h.payloadBytes);
+    memcpy(checkpointBuf, &h, sizeof(h));
+    return size;
+}
+
+static bool WriteCheckpointFile(const char *data, size_t size) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", checkpointPath);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { fprintf(stderr, "cannot write %s\n", tmp); return false; }
+    bool ok = fwrite(data, 1, size, f) == size && fflush(f) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(f)) == 0; // on disk before it replaces the last good checkpoint
+#endif
+    if (fclose(f) != 0) ok = false;
+    if (!ok) { fprintf(stderr, "cannot write %s\n", tmp); remove(tmp); return false; }
+#ifdef _WIN32
+    remove(checkpointPath); // rename does not replace on Windows
+#endif
+    if (rename(tmp, checkpointPath) != 0) { fprintf(stderr, "cannot replace %s\n", checkpointPath); return false; }
+    return true;
+}
+
+// Writer thread: owns checkpointBuf from CaptureCheckpoint until it clears checkpointBusy
+static _Atomic bool checkpointBusy = false;
+static size_t checkpointSize = 0;
+
+#ifndef _WIN32
+static pthread_t checkpointThread;
+static bool checkpointThreadJoinable = false;
+
+static void *CheckpointWriterMain(void *arg) {
+    (void)arg;
+    if (WriteCheckpointFile(checkpointBuf, checkpointSize)) checkpointsWritten++;
+    atomic_store(&checkpointBusy, false);
+    return NULL;
+}
+
+static void JoinCheckpointWriter(void) {
+    if (!checkpointThreadJoinable) return;
+    pthread_join(checkpointThread, NULL);
+    checkpointThreadJoinable = false;
+}
+#else
+static void JoinCheckpointWriter(void) {}
+#endif
+
+static void SaveCheckpoint(bool background) {
+    if (atomic_load(&checkpointBusy)) {
+        checkpointsSkipped++;
+        lastCheckpoint = simTime; // try again an interval later
+        return;
+    }
+    JoinCheckpointWriter();
+    checkpointSize = CaptureCheckpoint();
+    if (checkpointSize == 0) { fprintf(stderr, "out of memory for a checkpoint\n"); return; }
+    lastCheckpoint = simTime;
+#ifndef _WIN32
+    if (background) {
+        atomic_store(&checkpointBusy, true);
+        checkpointThreadJoinable = (pthread_create(&checkpointThread, NULL, CheckpointWriterMain, NULL) == 0);
+        if (checkpointThreadJoinable) return;
+        atomic_store(&checkpointBusy, false); // no thread: write it here
+    }
+#else
+    (void)background;
+#endif
+    if (WriteCheckpointFile(checkpointBuf, checkpointSize)) checkpointsWritten++;
+}
+
+static void MaybeCheckpoint(void) {
+    if (!checkpointPath || simTime - lastCheckpoint < checkpointInterval) return;
+    PROFILE_ZONE(PROF_CHECKPOINT);
+    SaveCheckpoint(true);
+}
+
+// Wait for the writer, then save the final state
+static void FinishCheckpoints(void) {
+    if (!checkpointPath) return;
+    JoinCheckpointWriter();
+    SaveCheckpoint(false);
+    free(checkpointBuf);
+    checkpointBuf = NULL;
+    checkpointBufCap = 0;
+}
+
+static bool CheckpointTake(const char **at, const char *end, void *dst, size_t n) {
+    if ((size_t)(end - *at) < n) return false;
+    memcpy(dst, *at, n);
+    *at += n;
+    return true;
+}
+
+// Load the state from a mapped checkpoint; call after InitVehicles/InitNetwork and seeding
+static bool ApplyCheckpoint(const char *data, size_t size) {
+    CheckpointHeader h;
+    if (size < sizeof(h)) return false;
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0 || h.version != CHECKPOINT_VERSION ||
+        h.histBuckets != HIST_BUCKETS || h.payloadBytes != size - sizeof(h) ||
+        h.checksum != Fnv1a(data + sizeof(h), h.payloadBytes) ||
+        h.vehicleHighWater < 0 || h.freeSlotCount < 0 || h.freeSlotCount > h.vehicleHighWater)
+        return false;
+#ifndef HEADLESS
+    if (h.gridRows != 1 || h.gridCols != 1) { fprintf(stderr, "the UI shows a single intersection\n"); return false; }
+#endif
+
+    screenW = h.screenW; screenH = h.screenH;
+    centerX = h.centerX; centerY = h.centerY;
+    if (h.gridRows != gridRows || h.gridCols != gridCols) {
+        fprintf(stderr, "checkpoint holds a %dx%d network, continuing with it instead of %dx%d\n",
+                h.gridRows, h.gridCols, gridRows, gridCols);
+        if (!InitNetwork(h.gridRows, h.gridCols)) return false;
+    }
+    if (nodeCount == 1) { nodes[0].cx = (float)centerX; nodes[0].cy = (float)centerY; }
+
+    int hw = h.vehicleHighWater, words = (hw + 63) / 64;
+    if (hw > vehicleMaxCapacity) {
+        fprintf(stderr, "checkpoint holds %d vehicle slots, raising --max-vehicles from %d\n", hw, vehicleMaxCapacity);
+        vehicleMaxCapacity = hw;
+    }
+    while (vehicleCapacity < hw)
+        if (!GrowVehiclePool()) return false;
+
+    const char *at = data + sizeof(h), *end = data + size;
+    bool ok = CheckpointTake(&at, end, vehicles.x, (size_t)hw * sizeof(float)) &&
+              CheckpointTake(&at, end, vehicles.y, (size_t)hw * sizeof(float)) &&
+              CheckpointTake(&at, end, vehicles.vx, (size_t)hw * sizeof(float)) &&
+              CheckpointTake(&at, end, vehicles.vy, (size_t)hw * sizeof(float)) &&
+              CheckpointTake(&at, end, vehicles.road, (size_t)hw) &&
+              CheckpointTake(&at, end, vehicles.lane, (size_t)hw) &&
+              CheckpointTake(&at, end, vehicles.node, (size_t)hw * sizeof(unsigned short)) &&
+              CheckpointTake(&at, end, vehicles.plate, (size_t)hw * sizeof(vehicles.plate[0])) &&
+              CheckpointTake(&at, end, vehicles.entryTime, (size_t)hw * sizeof(double)) &&
+              CheckpointTake(&at, end, vehicles.haltTime, (size_t)hw * sizeof(double)) &&
+              CheckpointTake(&at, end, vehicles.active, (size_t)words * sizeof(uint64_t)) &&
+              CheckpointTake(&at, end, freeSlots, (size_t)h.freeSlotCount * sizeof(int));
+    if (!ok) return false;
+    vehicleHighWater = hw;
+    freeSlotCount = h.freeSlotCount;
+
+    const char *queueData = at + (size_t)nodeCount * sizeof(CheckpointNode);
+    for (int n = 0; n < nodeCount && ok; n++) {
+        Intersection *node = &nodes[n];
+        CheckpointNode c;
+        ok = CheckpointTake(&at, end, &c, sizeof(c));
+        if (!ok) break;
+        memcpy(node->satTimer, c.satTimer, sizeof(c.satTimer));
+        node->currentGreen = c.currentGreen;
+        node->phaseTimer = c.phaseTimer;
+        node->greenDuration = c.greenDuration;
+        node->al2PriorityActive = c.al2PriorityActive != 0;
+        for (int r = 0; r < 4; r++)
+            for (int l = 0; l < 3; l++) {
+                LaneQueue *q = &node->queues[r][l];
+                q->count = 0; q->front = 0; q->rear = -1;
+                node->occupancy[r][l] = c.occupancy[r][l];
+                for (int k = 0; k < c.queueCount[r][l] && ok; k++) {
+                    int i;
+                    ok = CheckpointTake(&queueData, end, &i, sizeof(i)) && i >= 0 && i < hw;
+                    if (ok) ok = Enqueue(q, i);
+                }
+            }
+    }
+    at = queueData;
+    if (!ok || !CheckpointTake(&at, end, &metrics, sizeof(metrics)) || at != end) return false;
+
+    simTime = h.simTime;
+    nextSyntheticArrival = h.nextSyntheticArrival;
+    lastMetricsExport = h.lastMetricsExport;
+    lastCheckpoint = h.simTime;
+    simSeed = h.seed;
+    plateRng = h.rngs[0];
+    arrivalRng = h.rngs[1];
+    routingRng = h.rngs[2];
+    totalSpawned = h.totalSpawned;
+    totalExited = h.totalExited;
+    droppedSpawns = h.droppedSpawns;
+
+    // pick up the arrival log where the checkpoint left it (see IngestLogRecord)
+    ingestCursor.epoch = h.ingestEpoch;
+    ingestCursor.next = h.ingestNext;
+    arrivalLog = (ArrivalLogReader){h.ingestEpoch, 0, -1, h.ingestEpoch ? h.ingestNext : 0, (long)h.ingestLost};
+    vehiclesFilePos = h.ingestEpoch ? 0 : (long)h.ingestNext;
+    if (replayFile) {
+        replayConsumed = (long)h.replayConsumed;
+        replayNext = replayCount = 0;
+        fseek(replayFile, (long)(sizeof(ArrivalTraceHeader) + (size_t)replayConsumed * sizeof(ArrivalTraceRecord)), SEEK_SET);
+    }
+
+    h.policy[sizeof(h.policy) - 1] = '\0';
+    if (strcmp(h.policy, signalPolicy->name) != 0)
+        fprintf(stderr, "checkpoint was taken under policy %s, continuing with %s\n", h.policy, signalPolicy->name);
+    return true;
+}
+
+// Map the checkpoint file and load it
+static bool RestoreCheckpoint(const char *path) {
+    bool ok = false;
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            ok = ApplyCheckpoint(data, (size_t)st.st_size);
+            munmap(data, (size_t)st.st_size);
+        }
+    }
+    if (fd >= 0) close(fd);
+#else
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        char *data = (size > 0) ? malloc((size_t)size) : NULL;
+        fseek(f, 0, SEEK_SET);
+        if (data && fread(data, 1, (size_t)size, f) == (size_t)size) ok = ApplyCheckpoint(data, (size_t)size);
+        free(data);
+        fclose(f);
+    }
+#endif
+    if (!ok) fprintf(stderr, "cannot restore %s: missing, damaged or from another version\n", path);
+    return ok;
+}
+
+#ifdef SIM_DEBUG
+static void LaneInvariantFailed(int n, int r, int l, const char *what, int i) {
+    const LaneQueue *q = &nodes[n].queues[r][l];
+    fprintf(stderr, "lane invariant violated at t=%.3f node %d %c L%d: %s (vehicle %d, queue %d, table %d)\n",
+            simTime, n, 'A' + r, l + 1, what, i, q->count, nodes[n].occupancy[r][l]);
+    abort();
+}
+
+// Every live car is in exactly one queue, the one its node/road/lane name, at
+// the slot its handle says, behind its leader; queue counts match the
+// occupancy table. O(cars + lanes), so it can run every tick.
+static void CheckLaneQueues(void) {
+    int queued = 0, live = 0;
+    for (int n = 0; n < nodeCount; n++) for (int r = 0; r < 4; r++) for (int l = 0; l < 3; l++) {
+        const LaneQueue *q = &nodes[n].queues[r][l];
+        if (q->count != nodes[n].occupancy[r][l]) LaneInvariantFailed(n, r, l, "count differs from table", -1);
+        for (int k = 0; k < q->count; k++) {
+            int slot = (q->front + k) % q->capacity, i = q->indices[slot];
+            if (i < 0 || i >= vehicleHighWater || !IsVehicleActive(i)) LaneInvariantFailed(n, r, l, "queued car is not live", i);
+            if (vehicles.node[i] != n || vehicles.road[i] != r || vehicles.lane[i] != l)
+                LaneInvariantFailed(n, r, l, "queued car is on another lane", i);
+            if (vehicles.queueSlot[i] != slot) LaneInvariantFailed(n, r, l, "handle does not match slot", i);
+            if (k > 0 && LaneTravelCoordinate(i) > LaneTravelCoordinate(q->indices[(slot + q->capacity - 1) % q->capacity]) + 0.5f)
+                LaneInvariantFailed(n, r, l, "car is ahead of its leader", i);
+        }
+        queued += q->count;
+    }
+    for (int i = 0; i < vehicleHighWater; i++) live += IsVehicleActive(i);
+    if (queued != live) {
+        fprintf(stderr, "lane invariant violated at t=%.3f: %d live cars, %d queued\n", simTime, live, queued);
+        abort();
+    }
+}
+#endif
+
+// One simulation tick: ingest arrivals, update every intersection's signal, move vehicles
+static void SimulationStep(float dt) {
+    PROFILE_ZONE(PROF_TICK);
+    {
+        // pull new vehicles from the shared-memory ring, or the file without one
+        PROFILE_ZONE(PROF_INGEST);
+        IngestArrivals();
+    }
+    {
+        PROFILE_ZONE(PROF_PRIORITY);
+        if(signalPolicy->updatePriority)
+            for(int n=0;n<nodeCount;n++) signalPolicy->updatePriority(&nodes[n]);
+    }
+    {
+        PROFILE_ZONE(PROF_SIGNALS);
+        for(int n=0;n<nodeCount;n++) UpdateSignal(&nodes[n], dt);
+    }
+
+    UpdateVehicles(dt);
+
+#ifdef SIM_DEBUG
+    CheckLaneQueues();
+#endif
+
+    simTime += dt;
+    {
+        PROFILE_ZONE(PROF_METRICS);
+        ExportMetrics(false);
+    }
+    MaybeCheckpoint();
+}
+
+// benchmark.c includes this file with SIMULATOR_NO_MAIN to reach the internals.
+#ifndef SIMULATOR_NO_MAIN
+
+static bool useFileWatch = false; // --watch
+static bool seedGiven = false;     // --seed, else a fresh seed per run
+static int requestedThreads = 0;   // --threads, 0 = one per CPU
+static const char *restorePath = NULL; // --restore
+// --replay-speed: simulated seconds per wall second, 0 = as fast as possible
+#ifdef HEADLESS
+static double playbackSpeed = 0.0;
+#else
+static double playbackSpeed = 1.0;
+#endif
+static bool playbackSpeedGiven = false;
+
+// Command line options shared by the UI and headless builds.
+// Returns true if argv[*i] (and its value) was consumed.
+static bool ParseSimOption(int argc, char **argv, int *i) {
+    if (strcmp(argv[*i], "--max-vehicles") == 0 && *i + 1 < argc) {
+        vehicleMaxCapacity = atoi(argv[++*i]);
+        if (vehicleMaxCapacity < 1) vehicleMaxCapacity = 1;
+        return true;
+    }
+    if (strcmp(argv[*i], "--shm") == 0) {
+        useShmTransport = true;
+        return true;
+    }
+    if (strcmp(argv[*i], "--watch") == 0) {
+        useFileWatch = true;
+        return true;
+    }
+    if (strcmp(argv[*i], "--threads") == 0 && *i + 1 < argc) {
+        requestedThreads = atoi(argv[++*i]);
+        return true;
+    }
+    if (strcmp(argv[*i], "--metrics-csv") == 0 && *i + 1 < argc) {
+        metricsCsvPath = argv[++*i];
+        return true;
+    }
+    if (strcmp(argv[*i], "--metrics-json") == 0 && *i + 1 < argc) {
+        metricsJsonPath = argv[++*i];
+        return true;
+    }
+    if (strcmp(argv[*i], "--metrics-every") == 0 && *i + 1 < argc) {
+        metricsInterval = atof(argv[++*i]);
+        return metricsInterval > 0.0;
+    }
+    if (strcmp(argv[*i], "--arrivals") == 0 && *i + 1 < argc) {
+        syntheticRate = atof(argv[++*i]);
+        return syntheticRate > 0.0;
+    }
+    if (strcmp(argv[*i], "--time-per-vehicle") == 0 && *i + 1 < argc) {
+        timePerVehicle = (float)atof(argv[++*i]);
+        return timePerVehicle > 0.0f;
+    }
+    if (strcmp(argv[*i], "--speed") == 0 && *i + 1 < argc) {
+        vehSpeed = (float)atof(argv[++*i]);
+        return vehSpeed > 0.0f;
+    }
+    if (strcmp(argv[*i], "--min-headway") == 0 && *i + 1 < argc) {
+        minHeadway = (float)atof(argv[++*i]);
+        return minHeadway >= 0.0f;
+    }
+    if (strcmp(argv[*i], "--priority-on") == 0 && *i + 1 < argc) {
+        priorityOnThreshold = atoi(argv[++*i]);
+        return priorityOnThreshold >= 0;
+    }
+    if (strcmp(argv[*i], "--priority-off") == 0 && *i + 1 < argc) {
+        priorityOffThreshold = atoi(argv[++*i]);
+        return priorityOffThreshold >= 0;
+    }
+    if (strcmp(argv[*i], "--policy") == 0 && *i + 1 < argc) {
+        if (SelectSignalPolicy(argv[++*i])) return true;
+        fprintf(stderr, "unknown signal policy '%s'\n", argv[*i]);
+        return false;
+    }
+    if (strcmp(argv[*i], "--lane-weight") == 0 && *i + 1 < argc) {
+        if (ParseLaneWeight(argv[++*i])) return true;
+        fprintf(stderr, "bad lane weight '%s' (expected e.g. A2=3; only L2 and L3 can be weighted)\n", argv[*i]);
+        return false;
+    }
+    if (strcmp(argv[*i], "--trace") == 0 && *i + 1 < argc) {
+#ifdef SIM_PROFILE
+        profileTracePath = argv[++*i];
+#else
+        ++*i;
+        fprintf(stderr, "--trace needs a build with -DSIM_PROFILE, ignoring it\n");
+#endif
+        return true;
+    }
+    if (strcmp(argv[*i], "--checkpoint") == 0 && *i + 1 < argc) {
+        checkpointPath = argv[++*i];
+        return true;
+    }
+    if (strcmp(argv[*i], "--checkpoint-every") == 0 && *i + 1 < argc) {
+        checkpointInterval = atof(argv[++*i]);
+        return checkpointInterval > 0.0;
+    }
+    if (strcmp(argv[*i], "--restore") == 0 && *i + 1 < argc) {
+        restorePath = argv[++*i];
+        return true;
+    }
+    if (strcmp(argv[*i], "--record") == 0 && *i + 1 < argc) {
+        recordPath = argv[++*i];
+        return true;
+    }
+    if (strcmp(argv[*i], "--replay") == 0 && *i + 1 < argc) {
+        replayPath = argv[++*i];
+        return true;
+    }
+    if (strcmp(argv[*i], "--replay-speed") == 0 && *i + 1 < argc) {
+        const char *v = argv[++*i];
+        playbackSpeed = (strcmp(v, "max") == 0) ? 0.0 : atof(v);
+        playbackSpeedGiven = true;
+        return strcmp(v, "max") == 0 || playbackSpeed > 0.0;
+    }
+    if (strcmp(argv[*i], "--seed") == 0 && *i + 1 < argc) {
+        simSeed = strtoull(argv[++*i], NULL, 0);
+        seedGiven = true;
+        return true;
+    }
+    return false;
+}
+
+// Checks across options, once the command line is parsed
+static bool CheckSimOptions(void) {
+    if (priorityOffThreshold >= priorityOnThreshold) {
+        fprintf(stderr, "--priority-off (%d) must be below --priority-on (%d)\n",
+                priorityOffThreshold, priorityOnThreshold);
+        return false;
+    }
+    if (playbackSpeedGiven && !replayPath) {
+        fprintf(stderr, "--replay-speed needs --replay\n");
+        return false;
+    }
+    return true;
+}
+
+// Seed the run and open --replay/--record; a replay reuses the recorded seed unless --seed is given
+static bool SeedAndOpenTraces(float dt) {
+    if (replayPath) {
+        uint64_t traceSeed;
+        if (!OpenArrivalReplay(dt, &traceSeed)) return false;
+        if (!seedGiven) { simSeed = traceSeed; seedGiven = true; }
+    }
+    SeedSimulation(seedGiven ? simSeed : RngDefaultSeed());
+    return !recordPath || OpenArrivalRecord(dt);
+}
+
+// --restore: load the checkpoint over the freshly initialised state
+static bool RestoreFromCheckpoint(void) {
+    if (!restorePath) return true;
+    int64_t start = WallClockNs();
+    if (!RestoreCheckpoint(restorePath)) return false;
+    fprintf(stderr, "restored %s in %.1f ms: t=%.1fs, %ld vehicles spawned so far\n", restorePath,
+            (WallClockNs() - start) * 1e-6, simTime, totalSpawned);
+    return true;
+}
+
+static void CloseArrivalTraces(void) {
+    CloseArrivalRecord();
+    CloseArrivalReplay();
+    if (recordPath) printf("recorded %ld arrivals to %s\n", recordedArrivals, recordPath);
+    if (replayPath) printf("replayed %ld arrivals from %s\n", replayedArrivals, replayPath);
+}
+
+static void PrintUsage(const char *prog) {
+#ifdef HEADLESS
+    fprintf(stderr, "Usage: %s [--seconds N] [--dt SECONDS] [--grid RxC] [--engine step|event] [--max-vehicles N] [--shm] [--watch] [--seed N] [--threads N]\n"
+                    "       [--metrics-csv FILE] [--metrics-json FILE] [--metrics-every SECONDS] [--trace FILE]\n"
+                    "       [--policy NAME] [--lane-weight RL=W]... [--arrivals RATE]\n"
+                    "       [--time-per-vehicle S] [--speed PX/S] [--min-headway PX] [--priority-on N] [--priority-off N]\n"
+                    "       [--record FILE] [--replay FILE] [--replay-speed N|max]\n"
+                    "       [--checkpoint FILE] [--checkpoint-every SECONDS] [--restore FILE]\n", prog);
+#else
+    fprintf(stderr, "Usage: %s [--max-vehicles N] [--shm] [--watch] [--seed N] [--threads N]\n"
+                    "       [--metrics-csv FILE] [--metrics-json FILE] [--metrics-every SECONDS] [--trace FILE]\n"
+                    "       [--policy NAME] [--lane-weight RL=W]... [--arrivals RATE]\n"
+                    "       [--time-per-vehicle S] [--speed PX/S] [--min-headway PX] [--priority-on N] [--priority-off N]\n"
+                    "       [--record FILE] [--replay FILE] [--replay-speed N|max]\n"
+                    "       [--checkpoint FILE] [--checkpoint-every SECONDS] [--restore FILE]\n", prog);
+#endif
+    fprintf(stderr, "Signal policies:");
+    for (int k = 0; k < SIGNAL_POLICY_COUNT; k++) fprintf(stderr, " %s", signalPolicies[k].name);
+    fprintf(stderr, "\n--lane-weight RL=W: R is A-D, L is 2 or 3 (the weighted policy does not count L1)\n");
+}
+
+// Main loop
+
+#ifdef HEADLESS
+// FNV-1a over the simulation state, so two runs can be compared bit for bit
+static uint64_t StateDigest(void) {
+    uint64_t h = 0xCBF29CE484222325ull;
+#define DIGEST(p, n) for (size_t b = 0; b < (n); b++) h = (h ^ ((const unsigned char *)(p))[b]) * 0x100000001B3ull
+    for (int i = 0; i < vehicleHighWater; i++) {
+        if (!IsVehicleActive(i)) continue;
+        DIGEST(&i, sizeof(i));
+        DIGEST(&vehicles.x[i], sizeof(float));
+        DIGEST(&vehicles.y[i], sizeof(float));
+        DIGEST(&vehicles.vx[i], sizeof(float));
+        DIGEST(&vehicles.vy[i], sizeof(float));
+        DIGEST(&vehicles.node[i], sizeof(vehicles.node[i]));
+        DIGEST(&vehicles.road[i], 1);
+        DIGEST(&vehicles.lane[i], 1);
+        DIGEST(vehicles.plate[i], sizeof(vehicles.plate[i]));
+    }
+    DIGEST(&totalSpawned, sizeof(totalSpawned));
+    DIGEST(&totalExited, sizeof(totalExited));
+    DIGEST(&droppedSpawns, sizeof(droppedSpawns));
+    for (int n = 0; n < nodeCount; n++) {
+        DIGEST(&nodes[n].currentGreen, sizeof(nodes[n].currentGreen));
+        DIGEST(&nodes[n].phaseTimer, sizeof(nodes[n].phaseTimer));
+    }
+#undef DIGEST
+    return h;
+}
+
+// Hold the loop back to --replay-speed
+static void SleepUntilNs(int64_t targetNs) {
+    int64_t wait = targetNs - WallClockNs();
+    if (wait <= 0) return;
+#ifndef _WIN32
+    struct timespec ts = {(time_t)(wait / 1000000000), (long)(wait % 1000000000)};
+    nanosleep(&ts, NULL);
+#else
+    while (WallClockNs() < targetNs) {}
+#endif
+}
+
+// Discrete-event engine (--engine event, headless)
+// The time-stepped loop moves every car every dt, even when a junction is
+// idle or all its cars wait at a red light. Here each car instead keeps an
+// analytic trajectory: its position s along its lane (px from the lane's
+// start) at time t, and whether it drives at vehSpeed or stands. Cars in a
+// lane all drive at the same speed, so one only changes plan when the car
+// ahead starts or stops, the light changes or it reaches its lane's end, and
+// the time of its next change is known in advance. Those changes are events
+// in a binary min-heap: an arrival, a car reaching its stop point (the stop
+// line or the car ahead), a car free to move off, a car reaching the end of
+// its lane (crossing the box, hand-off or exit) and a phase ending. Popping
+// one costs O(log events); an event made stale by a later change is
+// skipped by its car's (or junction's) stamp. The lane queues, occupancy
+// table, signal policies, arrival sources and metrics are the ones the
+// time-stepped loop uses, so both report the same figures. The motion
+// model is simpler (a queue moves off as one, without the stepped loop's
+// tick of start-up lag per car) and cars held for the same exit lane take
+// turns by how long they waited, where the stepped loop serves them in
+// road order. Runs therefore differ car by car: means and throughput
+// agree within the spread between seeds until a grid with loops (2x2 and
+// up) is loaded into gridlock, where wait tails (p95/p99) part by 20-40%.
+// Checkpoints are not supported. A car held at the end of
+// its lane by full next lanes waits and is woken when one of the lanes it
+// can turn into gets room. Live sources (the file, --shm) are polled
+// every dt.
+
+typedef enum {
+    EV_ARRIVAL,     // next synthetic/replayed arrival, or a poll of a live source
+    EV_PHASE,       // id = intersection: its green phase ends
+    EV_STOP,        // id = car: reaches the stop line or the car ahead
+    EV_MOVE,        // id = car: the gap ahead has opened, it can move off
+    EV_LANE_END,    // id = car: reaches the box (approach lanes) or its lane's end
+} EventKind;
+
+typedef struct {
+    double time;
+    uint64_t order;   // push order, breaks ties so runs are reproducible
+    int kind;
+    int id;
+    uint32_t stamp;   // must still match the car's / junction's stamp when popped
+} SimEvent;
+
+typedef struct {
+    double s, t;      // lane position s at time t
+    uint32_t stamp;   // bumped whenever the car's pending event is replaced
+    double heldSince; // when it was first held at its lane's end
+    int want;         // node*12 + road*3 + lane it was last held for, -1 if not held
+    bool moving;
+    bool waiting;     // held at its lane's end until woken or its retry is due
+} EventCar;
+
+#define EVENT_EPS 0.01 // px
+
+static bool eventEngine = false;        // --engine event
+static SimEvent *eventHeap = NULL;
+static int eventCount = 0, eventCapacity = 0;
+static uint64_t eventOrder = 0;
+static long eventsProcessed = 0;
+static double eventPollDt = 1.0 / 60.0;  // --dt: live sources and held cars retry this often
+static EventCar *eventCars = NULL;
+static int eventCarCapacity = 0;
+static uint32_t *phaseStamp = NULL;     // per intersection
+static double *phaseStart = NULL;
+static bool eventQueueFull = false;     // an event could not be queued: the run ends early
+static long eventCarOverflows = 0;      // cars removed because eventCars could not grow
+
+static bool EventBefore(const SimEvent *a, const SimEvent *b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+static void PushEvent(double time, int kind, int id, uint32_t stamp) {
+    if (eventCount == eventCapacity) {
+        int newCap = eventCapacity ? eventCapacity * 2 : 1024;
+        if (!GrowArray((void **)&eventHeap, sizeof(SimEvent), newCap)) { eventQueueFull = true; return; }
+        eventCapacity = newCap;
+    }
+    SimEvent ev = {time, eventOrder++, kind, id, stamp};
+    int k = eventCount++;
+    while (k > 0 && EventBefore(&ev, &eventHeap[(k - 1) / 2])) {
+        eventHeap[k] = eventHeap[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    eventHeap[k] = ev;
+}
+
+static SimEvent PopEvent(void) {
+    SimEvent top = eventHeap[0], last = eventHeap[--eventCount];
+    int k = 0;
+    for (;;) {
+        int c = 2 * k + 1;
+        if (c >= eventCount) break;
+        if (c + 1 < eventCount && EventBefore(&eventHeap[c + 1], &eventHeap[c])) c++;
+        if (!EventBefore(&eventHeap[c], &last)) break;
+        eventHeap[k] = eventHeap[c];
+        k = c;
+    }
+    eventHeap[k] = last;
+    return top;
+}
+
+// Lane geometry in lane positions: approach lanes run in from their entry
+// point, exit lanes out from the box edge where crossing cars join them
+static float LaneStartDistance(const Intersection *n, int road, int lane) {
+    return (lane == 0) ? roadWidth / 2.0f + CAR_LEN : ApproachEntryDistance(n, road);
+}
+
+static double LaneEndPosition(const Intersection *n, int road, int lane) {
+    if (lane == 0) return ExitDistance(n, road) - LaneStartDistance(n, road, 0);
+    return ApproachEntryDistance(n, road) - roadWidth / 2.0f;
+}
+
+// Where ControlVehicle halts an L2 leader at a red light
+static double StopLinePosition(const Intersection *n, int road) {
+    return ApproachEntryDistance(n, road) - (roadWidth / 2.0f + 15.0f + CAR_LEN * 0.5f);
+}
+
+static double CarPosition(int i) {
+    const EventCar *c = &eventCars[i];
+    return c->moving ? c->s + vehSpeed * (simTime - c->t) : c->s;
+}
+
+static const LaneQueue *CarQueue(int i) {
+    return &nodes[vehicles.node[i]].queues[vehicles.road[i]][vehicles.lane[i]];
+}
+
+static int CarAhead(int i) {
+    const LaneQueue *q = CarQueue(i);
+    int slot = vehicles.queueSlot[i];
+    return (slot == q->front) ? -1 : q->indices[(slot + q->capacity - 1) % q->capacity];
+}
+
+static int CarBehind(int i) {
+    const LaneQueue *q = CarQueue(i);
+    int slot = vehicles.queueSlot[i];
+    return (slot == q->rear) ? -1 : q->indices[(slot + 1) % q->capacity];
+}
+
+static void WakeIfWaiting(const LaneQueue *q) {
+    if (q->count == 0) return;
+    int i = q->indices[q->front];
+    if (!eventCars[i].waiting) return;
+    eventCars[i].waiting = false;
+    PushEvent(simTime, EV_LANE_END, i, ++eventCars[i].stamp);
+}
+
+// A lane now has room at its start: wake the lane leaders that may be
+// waiting to move into it (every approach lane of the junction for an
+// exit lane, the neighbour's exit lane for an approach lane)
+static void WakeFeeders(int node, int road, int lane) {
+    const Intersection *n = &nodes[node];
+    if (lane == 0) {
+        for (int r = 0; r < 4; r++)
+            for (int l = 1; l < 3; l++) WakeIfWaiting(&n->queues[r][l]);
+    } else if (n->neighbor[road] >= 0) {
+        WakeIfWaiting(&nodes[n->neighbor[road]].queues[RoadOpposite(road)][0]);
+    }
+}
+
+// Decide what car i does from now on and schedule its next event. Returns
+// true if it started or stopped, which may change the car behind it.
+static bool PlanCar(int i) {
+    EventCar *c = &eventCars[i];
+    if (c->waiting) return false;
+    const Intersection *n = &nodes[vehicles.node[i]];
+    int road = vehicles.road[i], lane = vehicles.lane[i];
+    double s = CarPosition(i), target = LaneEndPosition(n, road, lane), moveOffAt = -1.0;
+    int kind = EV_LANE_END;
+
+    if (lane == 1 && road != n->currentGreen) {
+        double line = StopLinePosition(n, road);
+        if (s <= line + EVENT_EPS) { target = line; kind = EV_STOP; }
+    }
+    int ahead = CarAhead(i);
+    if (ahead >= 0) {
+        double spacing = CAR_LEN + minHeadway, aheadS = CarPosition(ahead);
+        if (!eventCars[ahead].moving) {
+            if (aheadS - spacing < target) { target = aheadS - spacing; kind = EV_STOP; }
+        } else if (aheadS - s < spacing - EVENT_EPS) {
+            moveOffAt = simTime + (spacing - (aheadS - s)) / vehSpeed;
+        }
+    }
+
+    bool wasMoving = c->moving;
+    bool canMove = (kind == EV_LANE_END) || s < target - EVENT_EPS;
+    c->s = s;
+    c->t = simTime;
+    c->stamp++;
+    c->moving = canMove && moveOffAt < 0.0;
+    if (c->moving) PushEvent(simTime + ((target > s) ? target - s : 0.0) / vehSpeed, kind, i, c->stamp);
+    else if (canMove) PushEvent(moveOffAt, EV_MOVE, i, c->stamp);
+    if (!c->moving && lane != 0 && vehicles.haltTime[i] < 0.0) vehicles.haltTime[i] = simTime;
+    return c->moving != wasMoving;
+}
+
+// Re-plan car i and, while that changes anything, each car behind it
+static void ReplanFrom(int i) {
+    while (i >= 0 && PlanCar(i)) {
+        const LaneQueue *q = CarQueue(i);
+        if (eventCars[i].moving && q->indices[q->rear] == i)
+            WakeFeeders(vehicles.node[i], vehicles.road[i], vehicles.lane[i]);
+        i = CarBehind(i);
+    }
+}
+
+// Replan the L2 cars of `road` that the light holds or releases: the first
+// one not yet past the stop line and, through ReplanFrom, those behind it
+static void ReplanSignalLane(int node, int road) {
+    const Intersection *n = &nodes[node];
+    const LaneQueue *q = &n->queues[road][1];
+    double line = StopLinePosition(n, road);
+    for (int k = 0; k < q->count; k++) {
+        int i = q->indices[(q->front + k) % q->capacity];
+        if (CarPosition(i) <= line + EVENT_EPS) { ReplanFrom(i); return; }
+    }
+}
+
+static void SchedulePhaseEnd(int node) {
+    phaseStart[node] = simTime;
+    PushEvent(simTime + nodes[node].greenDuration, EV_PHASE, node, ++phaseStamp[node]);
+}
+
+static void EndPhase(int node) {
+    Intersection *n = &nodes[node];
+    int was = n->currentGreen;
+    n->currentGreen = signalPolicy->nextGreen(n);
+    n->greenDuration = signalPolicy->greenDuration(n, n->currentGreen);
+    SchedulePhaseEnd(node);
+    if (n->currentGreen != was) { ReplanSignalLane(node, was); ReplanSignalLane(node, n->currentGreen); }
+}
+
+// The policy's priority hook reacts to lane counts; the time-stepped loop
+// runs it every tick, here whenever cars join or leave a junction's lanes
+static void CheckPriority(int node) {
+    if (!signalPolicy->updatePriority) return;
+    Intersection *n = &nodes[node];
+    bool wasActive = n->al2PriorityActive;
+    int wasGreen = n->currentGreen;
+    signalPolicy->updatePriority(n);
+    if (n->al2PriorityActive == wasActive) return;
+    if (n->al2PriorityActive) { phaseStart[node] = simTime; phaseStamp[node]++; } // phase held while active
+    else SchedulePhaseEnd(node);
+    if (n->currentGreen != wasGreen) { ReplanSignalLane(node, wasGreen); ReplanSignalLane(node, n->currentGreen); }
+}
+
+// Car i has just been queued at the start of its lane
+static void EventCarEntered(int i) {
+    if (i >= eventCarCapacity) {
+        if (!GrowArray((void **)&eventCars, sizeof(EventCar), vehicleCapacity)) {
+            // take the car out again, as JoinLane does when its queue cannot grow
+            int node = vehicles.node[i], road = vehicles.road[i], lane = vehicles.lane[i];
+            LeaveLane(&nodes[node], road, lane, i);
+            FreeVehicleSlot(i);
+            eventCarOverflows++;
+            WakeFeeders(node, road, lane);
+            return;
+        }
+        memset(eventCars + eventCarCapacity, 0, (size_t)(vehicleCapacity - eventCarCapacity) * sizeof(EventCar));
+        eventCarCapacity = vehicleCapacity;
+    }
+    EventCar *c = &eventCars[i];
+    c->s = 0.0;
+    c->t = simTime;
+    c->moving = c->waiting = false;
+    c->want = -1;
+    ReplanFrom(i);
+    CheckPriority(vehicles.node[i]);
+}
+
+// Seconds until a car can join `lane` of `node`: 0 if it has room at its
+// start, -1 while its last car stands too close to the start
+static double LaneRoomIn(int node, int road, int lane) {
+    const LaneQueue *q = &nodes[node].queues[road][lane];
+    if (q->count == 0) return 0.0;
+    int last = q->indices[q->rear];
+    double spacing = CAR_LEN + minHeadway, room = CarPosition(last);
+    if (room >= spacing - EVENT_EPS) return 0.0;
+    return eventCars[last].moving ? (spacing - room) / vehSpeed : -1.0;
+}
+
+// Another lane leader of `node` held longer than car i for exit lane `road`, or -1
+static int LongerHeldRival(int i, int node, int road) {
+    const Intersection *n = &nodes[node];
+    int want = node * 12 + road * 3, rival = -1;
+    double since = (eventCars[i].want >= 0) ? eventCars[i].heldSince : simTime;
+    for (int r = 0; r < 4; r++)
+        for (int l = 1; l < 3; l++) {
+            const LaneQueue *q = &n->queues[r][l];
+            if (q->count == 0) continue;
+            int j = q->indices[q->front];
+            if (j != i && eventCars[j].want == want && eventCars[j].heldSince < since) {
+                rival = j;
+                since = eventCars[j].heldSince;
+            }
+        }
+    return rival;
+}
+
+// Can car i move from the end of its lane into dest[0], the lane drawn for
+// it as in the time-stepped loop? If not, hold it there. The stepped loop
+// redraws the route every tick, so a held car also takes the other lane it
+// may use (dest[1..]) once that has room: while one has room the car draws
+// again one dt later, otherwise it retries when the first full lane's last
+// car has moved far enough in, or is woken when a lane whose last car
+// stands moves off. Where lanes merge onto an exit lane, a car reaching it
+// gives way to a leader held longer for it, so neither side starves.
+static bool NextLaneOpen(int i, int count, int dest[][3]) {
+    // a car woken for the lane it was held for takes it while it has room
+    if (count > 1 && eventCars[i].want == dest[1][0] * 12 + dest[1][1] * 3 + dest[1][2] &&
+        LaneRoomIn(dest[1][0], dest[1][1], dest[1][2]) == 0.0)
+        for (int f = 0; f < 3; f++) { int t = dest[0][f]; dest[0][f] = dest[1][f]; dest[1][f] = t; }
+    double retry = -1.0;
+    for (int k = 0; k < count; k++) {
+        double wait = LaneRoomIn(dest[k][0], dest[k][1], dest[k][2]);
+        if (wait == 0.0) {
+            int rival = (dest[k][2] == 0) ? LongerHeldRival(i, dest[k][0], dest[k][1]) : -1;
+            if (k == 0 && rival < 0) return true;
+            if (rival >= 0 && eventCars[rival].waiting) {
+                eventCars[rival].waiting = false;
+                PushEvent(simTime, EV_LANE_END, rival, ++eventCars[rival].stamp);
+            }
+            wait = eventPollDt;
+        }
+        if (wait > 0.0 && (retry < 0.0 || wait < retry)) retry = wait;
+    }
+    EventCar *c = &eventCars[i];
+    bool wasMoving = c->moving;
+    c->s = CarPosition(i);
+    c->t = simTime;
+    c->moving = false;
+    c->waiting = true;
+    c->stamp++;
+    if (c->want < 0) c->heldSince = simTime;
+    c->want = dest[0][0] * 12 + dest[0][1] * 3 + dest[0][2];
+    if (vehicles.lane[i] != 0 && vehicles.haltTime[i] < 0.0) vehicles.haltTime[i] = simTime;
+    if (retry > 0.0) PushEvent(simTime + retry, EV_LANE_END, i, c->stamp);
+    if (wasMoving && CarBehind(i) >= 0) ReplanFrom(CarBehind(i));
+    return false;
+}
+
+// Take car i off its lane, waking cars waiting for that lane if it emptied
+// and re-planning the car that now leads it
+static void EventLeaveLane(int i) {
+    int node = vehicles.node[i], road = vehicles.road[i], lane = vehicles.lane[i];
+    int behind = CarBehind(i);
+    LeaveLane(&nodes[node], road, lane, i);
+    if (nodes[node].queues[road][lane].count == 0) WakeFeeders(node, road, lane);
+    if (behind >= 0) ReplanFrom(behind);
+    if (lane != 0) CheckPriority(node);
+}
+
+// Car i has reached the end of its lane: cross the box onto an exit lane,
+// drive on to the neighbouring junction or leave the network
+static void CarReachedLaneEnd(int i) {
+    if (CarAhead(i) >= 0) { ReplanFrom(i); return; } // only a lane leader can leave it
+    eventCars[i].waiting = false;
+    int node = vehicles.node[i], road = vehicles.road[i], lane = vehicles.lane[i];
+    Intersection *n = &nodes[node];
+    int dest[2][3], count = 1;
+
+    if (lane != 0) {
+        if (lane == 2) dest[0][1] = RoadLeft(road);
+        else {
+            bool straight = RngRange(&routingRng, 0, 1) == 0;
+            dest[0][1] = straight ? RoadOpposite(road) : RoadRight(road);
+            dest[1][1] = straight ? RoadRight(road) : RoadOpposite(road);
+            count = 2;
+        }
+        dest[0][0] = dest[1][0] = node;
+        dest[0][2] = dest[1][2] = 0;
+        if (!NextLaneOpen(i, count, dest)) return;
+        RecordCrossing(i);
+        EventLeaveLane(i);
+        vehicles.road[i] = (unsigned char)dest[0][1];
+        vehicles.lane[i] = 0;
+        if (JoinLane(n, dest[0][1], 0, i)) EventCarEntered(i);
+    } else if (n->neighbor[road] >= 0) {
+        int to = n->neighbor[road];
+        bool leftLane = RngRange(&routingRng, 0, 2) == 0;
+        dest[0][0] = dest[1][0] = to;
+        dest[0][1] = dest[1][1] = RoadOpposite(road);
+        dest[0][2] = leftLane ? 2 : 1;
+        dest[1][2] = leftLane ? 1 : 2;
+        if (!NextLaneOpen(i, 2, dest)) return;
+        EventLeaveLane(i);
+        vehicles.node[i] = (unsigned short)to;
+        vehicles.road[i] = (unsigned char)dest[0][1];
+        vehicles.lane[i] = (unsigned char)dest[0][2];
+        StampLaneEntry(i);
+        if (JoinLane(&nodes[to], dest[0][1], dest[0][2], i)) EventCarEntered(i);
+    } else {
+        EventLeaveLane(i);
+        FreeVehicleSlot(i);
+        totalExited++;
+    }
+}
+
+// Next arrival event: the trace's or synthetic stream's next timestamp, or the next poll
+static void ScheduleArrivals(float dt) {
+    double next = simTime + dt;
+    if (replayFile) {
+        const ArrivalTraceRecord *rec = PeekReplay();
+        if (!rec) return;
+        next = rec->time;
+    } else if (syntheticRate > 0.0) {
+        if (nextSyntheticArrival < 0.0) nextSyntheticArrival = ExponentialGap(syntheticRate);
+        next = nextSyntheticArrival;
+    }
+    PushEvent((next > simTime) ? next : simTime, EV_ARRIVAL, 0, 0);
+}
+
+// Write the cars' positions and speeds at simTime into the pool, and each
+// junction's phase timer, as the time-stepped loop would have them
+static void SyncEventState(void) {
+    for (int i = 0; i < vehicleHighWater; i++) {
+        if (!IsVehicleActive(i)) continue;
+        const Intersection *n = &nodes[vehicles.node[i]];
+        int road = vehicles.road[i], lane = vehicles.lane[i];
+        float start = LaneStartDistance(n, road, lane), s = (float)CarPosition(i);
+        Vector2 pos = LanePoint(n, road, lane, (lane == 0) ? start + s : start - s);
+        vehicles.x[i] = pos.x;
+        vehicles.y[i] = pos.y;
+        if (eventCars[i].moving) SetLaneSpeed(i, vehSpeed);
+        else vehicles.vx[i] = vehicles.vy[i] = 0.0f;
+    }
+    for (int n = 0; n < nodeCount; n++)
+        nodes[n].phaseTimer = nodes[n].al2PriorityActive ? 0.0f : (float)(simTime - phaseStart[n]);
+}
+
+// Run until simTime reaches endTime, pacing against the wall clock at --replay-speed.
+// Returns false if it ran out of memory; the state is then synced at the time it stopped.
+static bool RunEventEngine(double endTime, float dt, double speed) {
+    phaseStamp = calloc((size_t)nodeCount, sizeof(uint32_t));
+    phaseStart = malloc((size_t)nodeCount * sizeof(double));
+    if (!phaseStamp || !phaseStart) return false;
+    eventPollDt = dt;
+    for (int n = 0; n < nodeCount; n++) SchedulePhaseEnd(n);
+    spawnHook = EventCarEntered;
+    ScheduleArrivals(dt);
+
+    int64_t start = WallClockNs();
+    while (!eventQueueFull && eventCount > 0 && eventHeap[0].time <= endTime) {
+        SimEvent ev = PopEvent();
+        if (speed > 0.0) SleepUntilNs(start + (int64_t)(ev.time / speed * 1e9));
+        // nothing changes between events, so exports due before this one are written at their own time
+        while ((metricsCsvPath || metricsJsonPath) && lastMetricsExport + metricsInterval <= ev.time) {
+            simTime = lastMetricsExport + metricsInterval;
+            ExportMetrics(false);
+        }
+        if (ev.kind == EV_PHASE) {
+            if (ev.stamp != phaseStamp[ev.id]) continue;
+        } else if (ev.kind != EV_ARRIVAL) {
+            if (!IsVehicleActive(ev.id) || ev.stamp != eventCars[ev.id].stamp) continue;
+        }
+        simTime = ev.time;
+        eventsProcessed++;
+        switch (ev.kind) {
+            case EV_ARRIVAL: IngestArrivals(); ScheduleArrivals(dt); break;
+            case EV_PHASE: EndPhase(ev.id); break;
+            case EV_STOP:
+            case EV_MOVE: ReplanFrom(ev.id); break;
+            case EV_LANE_END: CarReachedLaneEnd(ev.id); break;
+        }
+    }
+    if (!eventQueueFull) simTime = endTime;
+    spawnHook = NULL;
+    SyncEventState();
+    return !eventQueueFull;
+}
+
+int main(int argc, char **argv) {
+    double simSeconds = 3600.0;   // simulated time to run
+    float dt = 1.0f / 60.0f;      // fixed timestep, same as the 60 FPS UI
+    int rows = 1, cols = 1;       // --grid RxC intersections
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) simSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) dt = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &rows, &cols) != 2) rows = 0;
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            const char *engine = argv[++i];
+            eventEngine = strcmp(engine, "event") == 0;
+            if (!eventEngine && strcmp(engine, "step") != 0) rows = 0;
+        }
+        else if (!ParseSimOption(argc, argv, &i)) { PrintUsage(argv[0]); return 1; }
+    }
+    if (!CheckSimOptions()) return 1;
+    if (simSeconds <= 0.0 || dt <= 0.0f || rows < 1 || cols < 1 || (long)rows * cols > MAX_NETWORK_NODES) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (eventEngine && (checkpointPath || restorePath)) {
+        fprintf(stderr, "--checkpoint and --restore need the time-stepped engine\n");
+        return 1;
+    }
+
+    InitVehicles();
+    if (!InitNetwork(rows, cols)) { fprintf(stderr, "out of memory for a %dx%d grid\n", rows, cols); return 1; }
+    if (!SeedAndOpenTraces(dt) || !RestoreFromCheckpoint()) return 1;
+    StartWorkPool(requestedThreads);
+    if (useFileWatch) StartArrivalWatch();
+
+    long ticks = (long)(simSeconds / dt + 0.5);
+    int64_t start = WallClockNs(); // wall time, not clock(): CPU time adds up across threads
+    bool completed = true;
+    if (eventEngine) {
+        completed = RunEventEngine(ticks * (double)dt, dt, playbackSpeed);
+        if (!completed) fprintf(stderr, "out of memory for the event queue, run stopped at %.1fs\n", simTime);
+    } else {
+        for (long t = 0; t < ticks; t++) {
+            SimulationStep(dt);
+            if (playbackSpeed > 0.0) SleepUntilNs(start + (int64_t)((t + 1) * (double)dt / playbackSpeed * 1e9));
+        }
+    }
+    double wall = (WallClockNs() - start) * 1e-9;
+    int threads = simThreads;
+    StopArrivalWatch();
+    StopWorkPool();
+    CloseMetricsExport();
+    CloseArrivalTraces();
+    FinishCheckpoints();
+#ifdef SIM_PROFILE
+    if (profileTracePath) WriteProfileTrace(profileTracePath);
+#endif
+
+    int active = 0;
+    for (int i = 0; i < vehicleHighWater; i++) if (IsVehicleActive(i)) active++;
+
+    if (eventEngine)
+        printf("simulated %.1fs in %ld events (event engine) in %.3fs wall (%.0fx real time)\n",
+               simTime, eventsProcessed, wall, wall > 0 ? simTime / wall : 0.0);
+    else
+        printf("simulated %.1fs in %ld ticks (dt=%.4f) in %.3fs wall (%.0fx real time)\n",
+               ticks * dt, ticks, dt, wall, wall > 0 ? ticks * dt / wall : 0.0);
+    printf("network %dx%d, spawned %ld, exited %ld, active %d, dropped %ld, pool %d/%d, green %c\n",
+           gridRows, gridCols, totalSpawned, totalExited, active, droppedSpawns, vehicleCapacity,
+           vehicleMaxCapacity, 'A' + nodes[0].currentGreen);
+    printf("arrival log: next seq %llu, records lost to rotation %ld\n",
+           arrivalLog.nextSeq, arrivalLog.lostRecords);
+    LaneMetrics all = SummarizeLane(-1, 0);
+    LatencySummary ingest = SummarizeHistogram(&metrics.ingest);
+    printf("policy %s: wait p50/p95/p99/max %.2f/%.2f/%.2f/%.2fs (mean %.2fs), queue delay %.2f/%.2f/%.2f/%.2fs, "
+           "%.1f crossings/min\n",
+           signalPolicy->name, all.wait.p50, all.wait.p95, all.wait.p99, all.wait.max, all.wait.mean,
+           all.queueDelay.p50, all.queueDelay.p95, all.queueDelay.p99, all.queueDelay.max, all.throughput);
+    if (queueOverflows > 0)
+        printf("lane queues: %ld cars removed because a queue could not grow\n", queueOverflows);
+    if (eventCarOverflows > 0)
+        printf("event engine: %ld cars removed because its car table could not grow\n", eventCarOverflows);
+    if (checkpointPath)
+        printf("checkpoints: %ld written to %s, %ld skipped (writer busy)\n",
+               checkpointsWritten, checkpointPath, checkpointsSkipped);
+    if (ingest.count > 0)
+        printf("ingest latency p50/p99/max %.3f/%.3f/%.3fs over %ld records\n",
+               ingest.p50, ingest.p99, ingest.max, ingest.count);
+    printf("threads %d, seed %llu, state digest %016llx\n",
+           threads, (unsigned long long)simSeed, (unsigned long long)StateDigest());
+#ifdef SIM_PROFILE
+    PrintProfileSummary(stdout);
+#endif
+    return completed ? 0 : 1;
+}
+#else
+// Simulation thread (UI build): fixed SIM_TICK steps paced against GetTime(),
+// independent of the render loop's frame rate and VSync
+
+#define SIM_TICK (1.0 / 60.0)
+#define MAX_CATCHUP_TICKS 5 // after a stall, drop further backlog instead of spiralling
+
+static _Atomic int requestedScreenW = 1200; // window size seen by the render loop
+static _Atomic int requestedScreenH = 900;
+static _Atomic bool simThreadStop = false;
+static double nextTickTime = 0.0;
+
+// Follow a window resize: recentre the junction and shift every car with it
+static void ApplyWindowSize(int w, int h) {
+    screenW = w; screenH = h;
+    int newCenterX = screenW / 2, newCenterY = screenH / 2;
+    int dx = newCenterX - centerX, dy = newCenterY - centerY;
+    if (dx != 0 || dy != 0) {
+        for (int i = 0; i < vehicleHighWater; i++)
+            if (IsVehicleActive(i)) { vehicles.x[i] += dx; vehicles.y[i] += dy; }
+    }
+    centerX = newCenterX; centerY = newCenterY;
+    nodes[0].cx = (float)centerX; nodes[0].cy = (float)centerY;
+}
+
+// Wall seconds one tick lasts at the --replay-speed (a frame's worth at max)
+static double TickWallTime(void) {
+    return (playbackSpeed > 0.0) ? SIM_TICK / playbackSpeed : SIM_TICK;
+}
+
+// Run the ticks that are due, publish the result, and return seconds until the next one
+static double RunDueTicks(void) {
+    double now = GetTime();
+    if (now < nextTickTime) return nextTickTime - now;
+
+    ApplyWindowSize(atomic_load(&requestedScreenW), atomic_load(&requestedScreenH));
+    if (playbackSpeed <= 0.0) {
+        // as fast as possible: step for about a frame, then publish
+        do {
+            SavePreviousPositions();
+            SimulationStep((float)SIM_TICK);
+        } while (GetTime() - now < SIM_TICK);
+        nextTickTime = GetTime();
+        PublishSnapshot(nextTickTime);
+        return 0.0;
+    }
+
+    double tickWall = TickWallTime();
+    int maxTicks = MAX_CATCHUP_TICKS * (int)ceil(playbackSpeed);
+    for (int t = 0; t < maxTicks && now >= nextTickTime; t++) {
+        SavePreviousPositions();
+        SimulationStep((float)SIM_TICK);
+        nextTickTime += tickWall;
+    }
+    if (now >= nextTickTime) nextTickTime = now + tickWall;
+    PublishSnapshot(nextTickTime - tickWall);
+    return nextTickTime - GetTime();
+}
+
+#ifndef _WIN32
+static pthread_t simThread;
+static bool simThreadRunning = false;
+
+static void *SimulationThreadMain(void *arg) {
+    (void)arg;
+#ifdef SIM_PROFILE
+    profileThread = 1;
+#endif
+    while (!atomic_load(&simThreadStop)) {
+        double wait = RunDueTicks();
+        if (wait > 0) {
+            struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+#endif
+
+// Start stepping the simulation; without pthreads the render loop steps it instead
+static void StartSimulationThread(void) {
+    nextTickTime = GetTime();
+    RunDueTicks(); // first snapshot before the first frame
+#ifndef _WIN32
+    simThreadRunning = (pthread_create(&simThread, NULL, SimulationThreadMain, NULL) == 0);
+#endif
+}
+
+static void StopSimulationThread(void) {
+#ifndef _WIN32
+    if (!simThreadRunning) return;
+    atomic_store(&simThreadStop, true);
+    pthread_join(simThread, NULL);
+    simThreadRunning = false;
+#endif
+}
+
+static bool SimulationThreadRunning(void) {
+#ifndef _WIN32
+    return simThreadRunning;
+#else
+    return false;
+#endif
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++)
+        if (!ParseSimOption(argc, argv, &i)) { PrintUsage(argv[0]); return 1; }
+    if (!CheckSimOptions()) return 1;
+
+    SetConfigFlags(FLAG_WINDOW_RESIZABLE|FLAG_VSYNC_HINT);
+    InitWindow(screenW,screenH,"Queue Simulator - Raylib UI");
+    SetTargetFPS(60);
+
+    InitVehicles();
+    InitNetwork(1, 1); // the single on-screen intersection
+    if (!SeedAndOpenTraces((float)SIM_TICK) || !RestoreFromCheckpoint()) { CloseWindow(); return 1; }
+    if (replayPath)
+        SetWindowTitle(TextFormat("Queue Simulator - replaying %s at %s", replayPath,
+                                  playbackSpeed > 0.0 ? TextFormat("%gx", playbackSpeed) : "max speed"));
+    StartWorkPool(requestedThreads);
+    if (useFileWatch) StartArrivalWatch();
+    StartSimulationThread();
+    LoadCarAtlas();
+    LoadLegendLayer();
+
+    while(!WindowShouldClose()){
+        // the simulation thread applies resizes at its next tick
+        atomic_store(&requestedScreenW, GetScreenWidth());
+        atomic_store(&requestedScreenH, GetScreenHeight());
+        if(!SimulationThreadRunning()) RunDueTicks();
+
+        const SimSnapshot *snap=AcquireSnapshot();
+        float alpha=(float)((GetTime()-snap->tickStart)/TickWallTime()); // how far into the published tick we are
+        if(alpha<0.0f) alpha=0.0f;
+        if(alpha>1.0f) alpha=1.0f;
+
+        UpdateCamera2D();
+        UpdateRoadLayer(snap); // before BeginDrawing: it switches render targets
+
+        BeginDrawing();
+        ClearBackground(backgroundColor);
+        BeginMode2D(camera);
+        {
+            PROFILE_ZONE(PROF_DRAW_STATIC);
+            DrawLayer(roadLayer,0,0);
+        }
+        {
+            PROFILE_ZONE(PROF_DRAW_LIGHTS);
+            DrawLights(snap);
+        }
+        {
+            PROFILE_ZONE(PROF_DRAW_VEHICLES);
+            DrawVehicles(snap,alpha);
+        }
+        EndMode2D();
+        {
+            PROFILE_ZONE(PROF_DRAW_HUD);
+            DrawLayer(legendLayer,0,snap->screenH-60);
+            DrawLaneAlerts(snap);
+            DrawPriorityStatus(snap);
+            if(snap->al2PriorityActive)
+                DrawText("Green: A (AL2 priority hold)",20,20,22,BLACK);
+            else
+                DrawText(TextFormat("Green: %c   Phase: %.1f/%.1f   Policy: %s",'A'+snap->currentGreen,snap->phaseTimer,snap->greenDuration,signalPolicy->name),20,20,22,BLACK);
+            if(snap->droppedSpawns>0)
+                DrawText(TextFormat("Dropped arrivals: %ld (pool limit %d)",snap->droppedSpawns,snap->maxVehicles),20,snap->screenH-85,18,RED);
+            DrawMetricsOverlay(snap);
+#ifdef SIM_PROFILE
+            DrawProfileOverlay(snap);
+#endif
+            DrawRenderStats(snap);
+        }
+        PROFILE_ZONE(PROF_PRESENT);
         EndDrawing();
     }
 
+    StopSimulationThread();
+    CloseMetricsExport();
+    CloseArrivalTraces();
+    FinishCheckpoints();
+#ifdef SIM_PROFILE
+    PrintProfileSummary(stdout);
+    if (profileTracePath) WriteProfileTrace(profileTracePath);
+#endif
+    StopArrivalWatch();
+    StopWorkPool();
+    UnloadRenderTexture(carAtlas);
+    UnloadStaticLayers();
     CloseWindow();
     return 0;
 }
+#endif
+#endif // SIMULATOR_NO_MAIN
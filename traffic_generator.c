@@ -1,7 +1,10 @@
 // gcc traffic_generator.c -o traffic_generator.exe -lraylib -lopengl32 -lgdi32 -lwinmm
 
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef _WIN32
@@ -10,20 +13,74 @@
 #include <unistd.h>
 #endif
 
+#include "rng.h"
+#include "vehicle_ipc.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 // Filename for IPC with simulator
-#define FILENAME "vehicles.data"
+#define FILENAME VEHICLE_LOG_FILE
+#define STAGING_FILE VEHICLE_LOG_FILE ".rotating" // live segment while it is being rotated
 
 static FILE *g_file = NULL;
+static uint32_t g_epoch = 0;              // identifies this generator run in segment headers
+static unsigned long long g_seq = 0;      // sequence number of the next record
+static int g_segmentRecords = 0;          // records in the live segment
+static int g_rotatePending = 0;           // last rotation failed: retry on the next burst
+static int g_staged = 0;                  // the live segment is STAGING_FILE, not yet moved to .1
+static int g_textFormat = 0;              // --text: human-readable log lines
+static VehicleRing *g_ring = NULL; // set when publishing through shared memory (--shm)
+static Rng g_plateRng;                    // plate characters
+static Rng g_arrivalRng;                  // burst sizes, road/lane choice, gaps
+
+// Arrival models (--model): how many vehicles arrive when
+//   legacy   bursts of 1-3 (20%: 5-12) every 150-700 ms (10%: 30 ms)
+//   poisson  one at a time, exponential gaps at --rate per second
+//   bursty   Poisson bursts with geometric sizes (mean --burst), --rate on average
+//   diurnal  Poisson at --rate * (1 - --amplitude * cos(2 pi t / --period)),
+//            starting at the trough; the average is still --rate
+typedef enum { MODEL_LEGACY, MODEL_POISSON, MODEL_BURSTY, MODEL_DIURNAL } ArrivalModel;
+
+static const char *g_modelNames[] = {"legacy", "poisson", "bursty", "diurnal"};
+static ArrivalModel g_model = MODEL_LEGACY;
+static double g_rate = 10.0;              // --rate, vehicles per second
+static double g_burstMean = 8.0;          // --burst
+static double g_period = 86400.0;         // --period, seconds
+static double g_amplitude = 0.8;          // --amplitude, 0..1
+static int g_quiet = 0;                   // --quiet: no per-vehicle output
+static double g_reportEvery = 5.0;        // --report-every, seconds (0 = off)
+
+// Relative road/lane weights (--weight RL=W); the defaults reproduce the old
+// bias: L2 and L3 equally likely, L2 arrivals mildly favouring road A. L1 is
+// an exit lane the simulator does not spawn on, so it defaults to 0 and
+// --rate counts only cars the simulator will use.
+static double g_weights[4][3] = {
+    {0.0, 1.44, 1.0}, {0.0, 1.0, 1.0}, {0.0, 1.0, 1.0}, {0.0, 0.56, 1.0},
+};
+static double g_weightCdf[12];            // running sums of g_weights, road-major
 
 static void cleanup(void) {
+    if (g_ring) {
+        VehicleRingDestroy(g_ring);
+        g_ring = NULL;
+        return;
+    }
     // Close the open append handle if still open
     if (g_file) {
         fclose(g_file);
         g_file = NULL;
     }
-    // Truncate the vehicles file (delete contents)
+    // Truncate the vehicles file (delete contents) and drop rotated segments
     FILE *f = fopen(FILENAME, "w");
     if (f) fclose(f);
+    for (int k = 1; k <= VEHICLE_LOG_KEEP; k++) {
+        char name[64];
+        VehicleLogSegmentName(name, sizeof(name), k);
+        remove(name);
+    }
+    remove(STAGING_FILE);
 }
 
 #ifdef _WIN32
@@ -41,10 +98,6 @@ static void sigint_handler(int signo) {
 }
 #endif
 
-#define MAX_LINES 5000 ///Limits 5000 vehicles
-#define MAX_LINE_LENGTH 64
-#define TRIM_INTERVAL 1000
-
 // Cross-platform millisecond sleep
 static void sleep_ms(int ms) {
 #ifdef _WIN32
@@ -56,68 +109,262 @@ static void sleep_ms(int ms) {
 
 // Generate a random vehicle number
 static void GenerateVehicleNumber(char *buffer) {
-    buffer[0] = 'A' + rand() % 26;
-    buffer[1] = 'A' + rand() % 26;
-    buffer[2] = '0' + rand() % 10;
-    buffer[3] = 'A' + rand() % 26;
-    buffer[4] = 'A' + rand() % 26;
-    buffer[5] = '0' + rand() % 10;
-    buffer[6] = '0' + rand() % 10;
-    buffer[7] = '0' + rand() % 10;
+    buffer[0] = 'A' + RngRange(&g_plateRng, 0, 25);
+    buffer[1] = 'A' + RngRange(&g_plateRng, 0, 25);
+    buffer[2] = '0' + RngRange(&g_plateRng, 0, 9);
+    buffer[3] = 'A' + RngRange(&g_plateRng, 0, 25);
+    buffer[4] = 'A' + RngRange(&g_plateRng, 0, 25);
+    buffer[5] = '0' + RngRange(&g_plateRng, 0, 9);
+    buffer[6] = '0' + RngRange(&g_plateRng, 0, 9);
+    buffer[7] = '0' + RngRange(&g_plateRng, 0, 9);
     buffer[8] = '\0';
 }
 
-// Pick a road (A,B,C,D) and lane (0,1,2)
-static void PickRoadLane(char *road, int *lane) {
-    const char roads[] = {'A', 'B', 'C', 'D'};
-    *lane = rand() % 3;
+// Parse "RL=W" (road letter, lane 1-3, weight), e.g. A2=3
+static int ParseWeight(const char *text) {
+    char roadChar;
+    int lane;
+    double weight;
+    if (sscanf(text, "%c%d=%lf", &roadChar, &lane, &weight) != 3) return 0;
+    int road = RoadIndexFromChar(roadChar);
+    if (road < 0 || lane < 1 || lane > 3 || weight < 0.0) return 0;
+    g_weights[road][lane - 1] = weight;
+    return 1;
+}
+
+static int BuildWeightCdf(void) {
+    double sum = 0.0;
+    for (int k = 0; k < 12; k++) g_weightCdf[k] = (sum += g_weights[k / 3][k % 3]);
+    return sum > 0.0;
+}
+
+// Pick a road (0-3 = A-D) and lane (0,1,2) by weight
+static void PickRoadLane(int *road, int *lane) {
+    double x = RngUniform(&g_arrivalRng) * g_weightCdf[11];
+    int k = 0;
+    while (k < 11 && x >= g_weightCdf[k]) k++;
+    *road = k / 3;
+    *lane = k % 3;
+}
+
+static double ExponentialGap(double rate) {
+    return -log(1.0 - RngUniform(&g_arrivalRng)) / rate;
+}
 
-    if (*lane == 1) {
-        // Mildly favor AL2 while keeping other roads active.
-        int roll = rand() % 100;
-        if (roll < 36) *road = 'A';          // slight priority to AL2
-        else if (roll < 61) *road = 'B';     // remainder roughly even
-        else if (roll < 86) *road = 'C';
-        else *road = 'D';
+// Advance *t (seconds since start) to the next arrival event of the model
+// and return how many vehicles arrive at it
+static int NextArrival(double *t) {
+    switch (g_model) {
+    case MODEL_LEGACY: {
+        int delayMs = RngRange(&g_arrivalRng, 150, 699);    // 150-700ms typical gap
+        if (RngRange(&g_arrivalRng, 0, 99) < 10) delayMs = 30; // occasional near-immediate follow-up
+        *t += delayMs * 1e-3;
+        int burstSize = RngRange(&g_arrivalRng, 1, 3);
+        if (RngRange(&g_arrivalRng, 0, 99) < 20) burstSize = RngRange(&g_arrivalRng, 5, 12);
+        return burstSize;
+    }
+    case MODEL_POISSON:
+        *t += ExponentialGap(g_rate);
+        return 1;
+    case MODEL_BURSTY: {
+        *t += ExponentialGap(g_rate / g_burstMean);
+        if (g_burstMean <= 1.0) return 1;
+        double u = RngUniform(&g_arrivalRng);
+        return 1 + (int)floor(log(1.0 - u) / log(1.0 - 1.0 / g_burstMean));
+    }
+    case MODEL_DIURNAL:
+    default: {
+        // thinning: candidates at the peak rate, kept in proportion to the rate at their time
+        double peak = g_rate * (1.0 + g_amplitude);
+        for (;;) {
+            *t += ExponentialGap(peak);
+            double rate = g_rate * (1.0 - g_amplitude * cos(2.0 * M_PI * *t / g_period));
+            if (RngUniform(&g_arrivalRng) * peak < rate) return 1;
+        }
+    }
+    }
+}
+
+// Rate the model targets at time t (mean rate for legacy)
+static double TargetRate(double t) {
+    switch (g_model) {
+    case MODEL_LEGACY: return 3.3 / 0.3851; // mean burst / mean gap
+    case MODEL_DIURNAL: return g_rate * (1.0 - g_amplitude * cos(2.0 * M_PI * t / g_period));
+    default: return g_rate;
+    }
+}
+
+// Start a new live segment whose header names the first record it will hold
+static FILE *OpenSegment(unsigned long long baseSeq) {
+    FILE *file = fopen(FILENAME, "wb");
+    if (!file) return NULL;
+    if (g_textFormat) {
+        fprintf(file, "#SEG %u %llu\n", g_epoch, baseSeq);
     } else {
-        *road = roads[rand() % 4];
+        VehicleSegmentHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, VEHICLE_LOG_MAGIC, sizeof(h.magic));
+        h.version = VEHICLE_LOG_VERSION;
+        h.epoch = g_epoch;
+        h.recordSize = sizeof(VehicleRecord);
+        h.baseSeq = baseSeq;
+        fwrite(&h, sizeof(h), 1, file);
     }
+    fflush(file);
+    g_segmentRecords = 0;
+    return file;
 }
 
-// Keep only the last MAX_LINES entries in the file
-static void TrimFile(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) return;
+static int SegmentExists(int k) {
+    char name[64];
+    VehicleLogSegmentName(name, sizeof(name), k);
+    FILE *f = fopen(name, "rb");
+    if (f) fclose(f);
+    return f != NULL;
+}
 
-    char lines[MAX_LINES][MAX_LINE_LENGTH];
-    int count = 0;
+// Rotate vehicles.data -> .1 -> ... -> .VEHICLE_LOG_KEEP (oldest dropped) and
+// open a fresh live segment. Constant work regardless of how much was logged.
+// The live file is moved aside to STAGING_FILE first and segments only shift
+// up to the first free slot, so a rotation that fails part way (on Windows
+// while the simulator has a segment open) drops nothing when it is retried:
+// the live file is put back and reopened for appending, and the next burst
+// tries again. If it cannot be put back either, the generator appends to the
+// staged segment until a later rotation moves it to .1.
+static FILE *RotateSegments(FILE *file, unsigned long long baseSeq) {
+    char from[64], to[64];
+    fclose(file);
+    if (!g_staged) {
+        remove(STAGING_FILE);
+        if (rename(FILENAME, STAGING_FILE) != 0) {
+            g_rotatePending = 1;
+            return fopen(FILENAME, "ab");
+        }
+        g_staged = 1;
+    }
+    int top = 1;
+    while (top < VEHICLE_LOG_KEEP && SegmentExists(top)) top++;
+    int shifted = 1;
+    for (int k = top; k >= 1 && shifted; k--) {
+        if (k == 1) snprintf(from, sizeof(from), "%s", STAGING_FILE);
+        else VehicleLogSegmentName(from, sizeof(from), k - 1);
+        VehicleLogSegmentName(to, sizeof(to), k);
+        if (k == VEHICLE_LOG_KEEP) remove(to); // rename() does not replace an existing file on Windows
+        shifted = (rename(from, to) == 0);
+    }
+    if (!shifted) {
+        g_rotatePending = 1;
+        if (rename(STAGING_FILE, FILENAME) != 0) return fopen(STAGING_FILE, "ab");
+        g_staged = 0;
+        return fopen(FILENAME, "ab");
+    }
+    g_staged = 0;
+    g_rotatePending = 0;
+    return OpenSegment(baseSeq);
+}
 
-    while (fgets(lines[count % MAX_LINES], MAX_LINE_LENGTH, file)) {
-        count++;
+// Append a burst to the log: one fwrite per segment it lands in (text mode
+// writes a line per record), rotating whenever a segment fills up. After a
+// failed rotation the live segment takes the whole burst past its limit and
+// the rotation is retried once per burst.
+static FILE *WriteRecords(FILE *file, const VehicleRecord *recs, int n) {
+    if (g_rotatePending && file && n > 0) file = RotateSegments(file, recs->seq);
+    while (n > 0 && file) {
+        int room = g_rotatePending ? n : VEHICLE_LOG_SEGMENT_RECORDS - g_segmentRecords;
+        int chunk = (n < room) ? n : room;
+        if (g_textFormat) {
+            for (int k = 0; k < chunk; k++)
+                fprintf(file, "%llu:%s:%c:%d\n", (unsigned long long)recs[k].seq, recs[k].plate,
+                        'A' + recs[k].road, recs[k].lane);
+        } else {
+            fwrite(recs, sizeof(VehicleRecord), (size_t)chunk, file);
+        }
+        fflush(file);
+        g_segmentRecords += chunk;
+        recs += chunk;
+        n -= chunk;
+        if (!g_rotatePending && g_segmentRecords >= VEHICLE_LOG_SEGMENT_RECORDS)
+            file = RotateSegments(file, n > 0 ? recs->seq : g_seq); // seqs of a burst are assigned up front
     }
-    fclose(file);
+    return file;
+}
 
-    if (count <= MAX_LINES) return;
+// Publish a burst through the ring, waiting while the simulator catches up
+static void PushToRing(const VehicleRecord *recs, int n) {
+    while (n > 0) {
+        int pushed = VehicleRingPush(g_ring, recs, n);
+        recs += pushed;
+        n -= pushed;
+        if (n > 0) sleep_ms(1);
+    }
+}
 
-    file = fopen(filename, "w");
-    if (!file) return;
+static void PrintUsage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--shm] [--text] [--seed N] [--quiet] [--report-every SECONDS]\n"
+                    "       [--model legacy|poisson|bursty|diurnal] [--rate PER_SECOND] [--burst MEAN]\n"
+                    "       [--period SECONDS] [--amplitude A] [--weight RL=W]...\n"
+                    "--weight: L1 defaults to 0; the simulator drops L1 arrivals\n", prog);
+}
 
-    int start = count % MAX_LINES;
-    for (int i = 0; i < MAX_LINES; i++) {
-        fputs(lines[(start + i) % MAX_LINES], file);
+static int ParseModel(const char *name) {
+    for (int k = 0; k < (int)(sizeof(g_modelNames) / sizeof(g_modelNames[0])); k++) {
+        if (strcmp(name, g_modelNames[k]) == 0) {
+            g_model = (ArrivalModel)k;
+            return 1;
+        }
     }
-
-    fclose(file);
+    return 0;
 }
 
-int main(void) {
-    FILE *file = fopen(FILENAME, "a");
-    if (!file) {
-        perror("Error opening vehicles.data");
+#define MAX_BATCH 4096 // records written or pushed at once
+
+int main(int argc, char **argv) {
+    int useShm = 0;
+    int modelGiven = 0, rateGiven = 0;
+    uint64_t seed = RngDefaultSeed();
+    for (int i = 1; i < argc; i++) {
+        int ok = 1;
+        if (strcmp(argv[i], "--shm") == 0) useShm = 1;
+        else if (strcmp(argv[i], "--text") == 0) g_textFormat = 1;
+        else if (strcmp(argv[i], "--quiet") == 0) g_quiet = 1;
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) ok = modelGiven = ParseModel(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) ok = rateGiven = (g_rate = atof(argv[++i])) > 0.0;
+        else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) ok = (g_burstMean = atof(argv[++i])) >= 1.0;
+        else if (strcmp(argv[i], "--period") == 0 && i + 1 < argc) ok = (g_period = atof(argv[++i])) > 0.0;
+        else if (strcmp(argv[i], "--amplitude") == 0 && i + 1 < argc) {
+            g_amplitude = atof(argv[++i]);
+            ok = g_amplitude >= 0.0 && g_amplitude <= 1.0;
+        }
+        else if (strcmp(argv[i], "--report-every") == 0 && i + 1 < argc) ok = (g_reportEvery = atof(argv[++i])) >= 0.0;
+        else if (strcmp(argv[i], "--weight") == 0 && i + 1 < argc) ok = ParseWeight(argv[++i]);
+        else ok = 0;
+        if (!ok) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (rateGiven && !modelGiven) g_model = MODEL_POISSON; // a rate alone means a Poisson stream
+    if (!BuildWeightCdf()) {
+        fprintf(stderr, "--weight: at least one road/lane needs a positive weight\n");
         return 1;
     }
 
-    g_file = file;
+    FILE *file = NULL;
+    if (useShm) {
+        g_ring = VehicleRingCreate();
+        if (!g_ring) fprintf(stderr, "Shared memory unavailable, falling back to %s\n", FILENAME);
+    }
+    if (!g_ring) {
+        g_epoch = (uint32_t)time(NULL) ^ ((uint32_t)clock() << 16);
+        if (g_epoch == 0) g_epoch = 1;
+        file = OpenSegment(g_seq);
+        if (!file) {
+            perror("Error opening vehicles.data");
+            return 1;
+        }
+        g_file = file;
+    }
 
     /* register cleanup handlers so the file is truncated when this generator exits */
     atexit(cleanup);
@@ -125,48 +372,70 @@ int main(void) {
     SetConsoleCtrlHandler(CtrlHandler, TRUE);
 #else
     signal(SIGINT, sigint_handler);
+    signal(SIGTERM, sigint_handler);
 #endif
 
-    srand((unsigned int)time(NULL));
+    RngSeed(&g_plateRng, seed, RNG_STREAM_PLATES);
+    RngSeed(&g_arrivalRng, seed, RNG_STREAM_ARRIVALS);
+    fprintf(stderr, "Seed: %llu, model %s", (unsigned long long)seed, g_modelNames[g_model]);
+    if (g_model != MODEL_LEGACY) fprintf(stderr, " at %g/s", g_rate);
+    fprintf(stderr, "\n");
 
-    int vehicleCount = 0;
+    // Arrival events are scheduled on a virtual clock (seconds since start).
+    // Each pass emits everything due by now in batches, then sleeps until
+    // the next event, so high rates cost one write per batch rather than a
+    // sleep per vehicle; if emitting falls behind, the report shows the lag.
+    static VehicleRecord batch[MAX_BATCH];
+    int64_t startNs = WallClockNs();
+    double nextEvent = 0.0;
+    int pending = NextArrival(&nextEvent); // vehicles still to emit at nextEvent
+    unsigned long long lastReportSeq = 0;
+    double lastReport = 0.0;
 
     while (1) {
-        // Decide how many vehicles to emit this tick. Roughly:
-        // - 20% chance of a burst (5-12 vehicles)
-        // - otherwise 1-3 vehicles
-        int burstSize = 1 + rand() % 3;
-        if ((rand() % 100) < 20) burstSize = 5 + rand() % 8;
-
-        for (int i = 0; i < burstSize; i++) {
-            char plate[9];
-            char road;
-            int lane;
-
-            GenerateVehicleNumber(plate);
+        int64_t nowNs = WallClockNs();
+        double now = (nowNs - startNs) * 1e-9;
+        int n = 0;
+        while (n < MAX_BATCH && nextEvent <= now) {
+            VehicleRecord *rec = &batch[n++];
+            memset(rec, 0, sizeof(*rec));
+            int road, lane;
+            GenerateVehicleNumber(rec->plate);
             PickRoadLane(&road, &lane);
+            rec->seq = g_seq++;
+            rec->emitNs = startNs + (int64_t)(nextEvent * 1e9); // when it was due, so lag shows as ingest latency
+            rec->road = (uint8_t)road;
+            rec->lane = (uint8_t)lane;
+            if (!g_quiet) printf("Generated: %s:%c:%d\n", rec->plate, 'A' + road, lane);
+            if (--pending == 0) pending = NextArrival(&nextEvent);
+        }
 
-            fprintf(file, "%s:%c:%d\n", plate, road, lane);
-            fflush(file);
-
-            printf("Generated: %s:%c:%d\n", plate, road, lane);
-
-            vehicleCount++;
-            if (vehicleCount % TRIM_INTERVAL == 0) {
-                fclose(file);
-                TrimFile(FILENAME);
-                file = fopen(FILENAME, "a");
-                if (!file) return 0;
+        if (n > 0) {
+            if (g_ring) {
+                PushToRing(batch, n);
+            } else {
+                file = WriteRecords(file, batch, n);
                 g_file = file;
+                if (!file) return 0;
             }
         }
 
-        // Randomize delay so bursts sometimes pile up and trigger saturation in UI.
-        int delayMs = 150 + rand() % 550;      // 150-700ms typical gap
-        if ((rand() % 100) < 10) delayMs = 30; // occasional near-immediate follow-up
-        sleep_ms(delayMs);
+        if (g_reportEvery > 0.0 && now - lastReport >= g_reportEvery) {
+            double span = now - lastReport;
+            double behind = (nextEvent < now) ? now - nextEvent : 0.0;
+            fprintf(stderr, "t=%.1fs emitted %llu, %.0f/s over the last %.1fs (target %.0f/s), behind %.3fs\n",
+                    now, g_seq, (g_seq - lastReportSeq) / span, span, TargetRate(now), behind);
+            lastReport = now;
+            lastReportSeq = g_seq;
+        }
+
+        // nothing due (or a full batch just went out): wait for the next event
+        if (n < MAX_BATCH) {
+            double wait = nextEvent - (WallClockNs() - startNs) * 1e-9;
+            if (wait > 0.0) sleep_ms(wait < 1e-3 ? 1 : (int)(wait * 1000.0));
+        }
     }
 
-    fclose(file);
+    if (file) fclose(file);
     return 0;
 }
@@ -0,0 +1,218 @@
+// Vehicle arrival transport shared by traffic_generator.c and simulator.c.
+//
+// vehicles.data is a segmented log. Every VEHICLE_LOG_SEGMENT_RECORDS records
+// the generator renames it to vehicles.data.1 (shifting older segments up to
+// .VEHICLE_LOG_KEEP, the oldest is dropped) and starts a new file. Each
+// segment starts with a header naming the generator run (epoch) and the
+// sequence number of its first record; seq grows by one per vehicle for the
+// whole run, so a reader resumes at an exact record no matter how many
+// rotations happened in between, and trimming is a few renames.
+// A rotation that cannot rename (a reader holds the file open on Windows)
+// leaves the live segment growing past the limit until a later one succeeds.
+//
+// Segments come in two formats, told apart by the header:
+// - binary (default): VehicleSegmentHeader followed by VehicleRecords
+// - text (generator --text, for debugging): a "#SEG <epoch> <first seq>"
+//   line followed by "<seq>:PLATE:ROAD:LANE" lines
+//
+// Besides the log file, the generator can publish arrivals
+// through a POSIX shared-memory ring of fixed-size binary records. The ring
+// is single-producer/single-consumer: the generator only advances `head`,
+// the simulator only advances `tail`, so a poll is a pair of atomic loads.
+// Not available on Windows; callers fall back to the file there.
+
+#ifndef VEHICLE_IPC_H
+#define VEHICLE_IPC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define VEHICLE_LOG_FILE "vehicles.data"
+#define VEHICLE_LOG_SEGMENT_RECORDS 1000
+#define VEHICLE_LOG_KEEP 4               // rotated segments kept besides the live one
+
+// Segment k of the log: 0 is the live file, 1..VEHICLE_LOG_KEEP are older
+static inline void VehicleLogSegmentName(char *buf, size_t size, int k) {
+    if (k == 0) snprintf(buf, size, "%s", VEHICLE_LOG_FILE);
+    else snprintf(buf, size, "%s.%d", VEHICLE_LOG_FILE, k);
+}
+
+#define VEHICLE_SHM_NAME "/dsa_queue_vehicles"
+#define VEHICLE_RING_MAGIC 0x56524E47u   // "VRNG"
+#define VEHICLE_RING_VERSION 2u
+#define VEHICLE_RING_CAPACITY 65536u     // records, must be a power of two
+
+#define VEHICLE_LOG_MAGIC "VSEG"
+#define VEHICLE_LOG_VERSION 1u
+
+// One arrival: plate text, road 0=A..3=D, lane 0=L1..2=L3 (40 bytes, host byte order)
+typedef struct {
+    uint64_t seq;            // per-run sequence number
+    int64_t emitNs;          // wall clock the generator scheduled it for, ns since the Unix epoch
+    char plate[16];
+    uint8_t road;
+    uint8_t lane;
+    uint8_t reserved[6];
+} VehicleRecord;
+
+// Header of a binary log segment
+typedef struct {
+    char magic[4];           // VEHICLE_LOG_MAGIC
+    uint32_t version;        // VEHICLE_LOG_VERSION
+    uint32_t epoch;          // generator run
+    uint32_t recordSize;     // sizeof(VehicleRecord)
+    uint64_t baseSeq;        // seq of the first record in this segment
+} VehicleSegmentHeader;
+
+static inline int64_t WallClockNs(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int RoadIndexFromChar(char c) {
+    return (c >= 'A' && c <= 'D') ? c - 'A' : -1;
+}
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct {
+    _Atomic uint32_t magic;                  // written last by the producer
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t recordSize;
+    _Atomic uint32_t closed;                 // producer exited; consumer should re-attach
+    _Alignas(64) _Atomic uint64_t head;      // next record the producer writes
+    _Alignas(64) _Atomic uint64_t tail;      // next record the consumer reads
+    _Alignas(64) VehicleRecord records[];
+} VehicleRing;
+
+static inline size_t VehicleRingBytes(void) {
+    return sizeof(VehicleRing) + (size_t)VEHICLE_RING_CAPACITY * sizeof(VehicleRecord);
+}
+
+// Reset a ring (shared or process-local, VehicleRingBytes() long) to empty
+static inline void VehicleRingInit(VehicleRing *ring) {
+    ring->capacity = VEHICLE_RING_CAPACITY;
+    ring->recordSize = sizeof(VehicleRecord);
+    ring->version = VEHICLE_RING_VERSION;
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->closed, 0);
+    atomic_store_explicit(&ring->magic, VEHICLE_RING_MAGIC, memory_order_release);
+}
+
+static inline VehicleRing *VehicleRingMap(int fd) {
+    void *p = mmap(NULL, VehicleRingBytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (p == MAP_FAILED) ? NULL : (VehicleRing *)p;
+}
+
+// Producer side: retire any ring left by an earlier generator (so attached
+// consumers see it closed) and create a fresh, empty one
+static inline VehicleRing *VehicleRingCreate(void) {
+    int fd = shm_open(VEHICLE_SHM_NAME, O_RDWR, 0600);
+    if (fd >= 0) {
+        if (lseek(fd, 0, SEEK_END) >= (off_t)VehicleRingBytes()) {
+            VehicleRing *old = VehicleRingMap(fd);
+            if (old) {
+                atomic_store(&old->closed, 1);
+                munmap(old, VehicleRingBytes());
+            }
+        } else {
+            close(fd);
+        }
+        shm_unlink(VEHICLE_SHM_NAME);
+    }
+
+    fd = shm_open(VEHICLE_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, (off_t)VehicleRingBytes()) != 0) { close(fd); return NULL; }
+    VehicleRing *ring = VehicleRingMap(fd);
+    if (ring) VehicleRingInit(ring);
+    return ring;
+}
+
+// Consumer side: attach to a ring the generator has already created
+static inline VehicleRing *VehicleRingAttach(void) {
+    int fd = shm_open(VEHICLE_SHM_NAME, O_RDWR, 0600);
+    if (fd < 0) return NULL;
+    if (lseek(fd, 0, SEEK_END) < (off_t)VehicleRingBytes()) { close(fd); return NULL; }
+    VehicleRing *ring = VehicleRingMap(fd);
+    if (!ring) return NULL;
+    uint32_t magic = atomic_load_explicit(&ring->magic, memory_order_acquire);
+    if (magic != VEHICLE_RING_MAGIC || ring->version != VEHICLE_RING_VERSION ||
+        ring->capacity != VEHICLE_RING_CAPACITY || ring->recordSize != sizeof(VehicleRecord) ||
+        atomic_load(&ring->closed)) {
+        munmap(ring, VehicleRingBytes());
+        return NULL;
+    }
+    return ring;
+}
+
+static inline void VehicleRingDetach(VehicleRing *ring) {
+    if (ring) munmap(ring, VehicleRingBytes());
+}
+
+static inline bool VehicleRingClosed(VehicleRing *ring) {
+    return atomic_load_explicit(&ring->closed, memory_order_acquire) != 0;
+}
+
+// Producer: mark the ring closed and remove its name so the next generator starts fresh
+static inline void VehicleRingDestroy(VehicleRing *ring) {
+    if (!ring) return;
+    atomic_store(&ring->closed, 1);
+    VehicleRingDetach(ring);
+    shm_unlink(VEHICLE_SHM_NAME);
+}
+
+// Producer: free record slots
+static inline int VehicleRingRoom(VehicleRing *ring) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return (int)(VEHICLE_RING_CAPACITY - (head - tail));
+}
+
+// Producer: append up to n records; returns how many fit
+static inline int VehicleRingPush(VehicleRing *ring, const VehicleRecord *recs, int n) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint64_t room = VEHICLE_RING_CAPACITY - (head - tail);
+    if ((uint64_t)n > room) n = (int)room;
+    for (int k = 0; k < n; k++)
+        ring->records[(head + k) & (VEHICLE_RING_CAPACITY - 1)] = recs[k];
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+// Consumer: take up to max records; returns how many were read
+static inline int VehicleRingPop(VehicleRing *ring, VehicleRecord *out, int max) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t avail = head - tail;
+    if (avail > VEHICLE_RING_CAPACITY) return 0; // torn/foreign ring; caller re-attaches
+    int n = (avail < (uint64_t)max) ? (int)avail : max;
+    for (int k = 0; k < n; k++)
+        out[k] = ring->records[(tail + k) & (VEHICLE_RING_CAPACITY - 1)];
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+#else
+typedef struct VehicleRing VehicleRing;
+static inline VehicleRing *VehicleRingCreate(void) { return NULL; }
+static inline VehicleRing *VehicleRingAttach(void) { return NULL; }
+static inline void VehicleRingDetach(VehicleRing *ring) { (void)ring; }
+static inline bool VehicleRingClosed(VehicleRing *ring) { (void)ring; return true; }
+static inline void VehicleRingDestroy(VehicleRing *ring) { (void)ring; }
+static inline int VehicleRingPush(VehicleRing *ring, const VehicleRecord *recs, int n) { (void)ring; (void)recs; (void)n; return 0; }
+static inline int VehicleRingPop(VehicleRing *ring, VehicleRecord *out, int max) { (void)ring; (void)out; (void)max; return 0; }
+#endif
+
+#endif // VEHICLE_IPC_H